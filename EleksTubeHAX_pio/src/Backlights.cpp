@@ -1,4 +1,8 @@
 #include "Backlights.h"
+#include "Metrics.h"
+#include <SPIFFS.h>
+
+static_assert(NUM_DIGITS <= BACKLIGHTS_PROGRAM_MAX_LEDS, "the program format has one mask bit per LED");
 
 void Backlights::begin(StoredConfig::Config::Backlights *config_)  {
   config=config_;
@@ -16,6 +20,38 @@ void Backlights::begin(StoredConfig::Config::Backlights *config_)  {
   }
 
   off = false;
+  configChanged();
+
+  program_mutex = xSemaphoreCreateMutexStatic(&program_mutex_buffer);
+
+  // Higher priority than loop(), so a frame is never late because loop() is busy.
+  if (xTaskCreate(renderTask, "backlights", 3072, this, 2, &task_handle) != pdPASS) {
+    Serial.println("Backlights task failed to start.");
+    return;
+  }
+  metrics.registerTask(Metrics::task_leds, task_handle);
+}
+
+void Backlights::renderTask(void *parameter) {
+  Backlights *self = (Backlights *)parameter;
+  TickType_t last_wake = xTaskGetTickCount();
+  uint32_t last_frame_us = micros();
+  while (true) {
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(BACKLIGHTS_FRAME_MS));
+    uint32_t frame_us = micros();
+    self->frame_log[self->frame_log_index] = frame_us;
+    self->frame_log_index = (self->frame_log_index + 1) % frame_log_size;
+    metrics.recordLedFrame(frame_us - last_frame_us);
+    last_frame_us = frame_us;
+    self->loop(millis());
+  }
+}
+
+void Backlights::getFrameTimes(uint32_t times[frame_log_size]) {
+  uint8_t start = frame_log_index;
+  for (uint8_t i = 0; i < frame_log_size; i++) {
+    times[i] = frame_log[(start + i) % frame_log_size];
+  }
 }
 
 
@@ -47,11 +83,17 @@ void Backlights::adjustIntensity(int16_t adj) {
 
 void Backlights::setIntensity(uint8_t intensity) {
   config->intensity = intensity;
-  setBrightness(0xFF >> max_intensity - config->intensity - 1);
-  pattern_needs_init = true;
+  // The brightness is applied by the render task.
+  configChanged();
 }
 
-void Backlights::loop() {
+void Backlights::loop(uint32_t now_ms) {
+  uint32_t generation = config_generation;
+  pattern_needs_init = (generation != rendered_generation);
+  // Pulse and breath both use breath_per_min.
+  BacklightsAdvancePhases(&phases, now_ms - last_frame_ms, config->breath_per_min);
+  last_frame_ms = now_ms;
+
   //   enum patterns { dark, test, constant, rainbow, pulse, breath, num_patterns };
   if (off || config->pattern == dark) {
     if (pattern_needs_init) {
@@ -60,16 +102,16 @@ void Backlights::loop() {
     }
   }
   else if (config->pattern == test) {
-    testPattern();
+    testPattern(now_ms);
   }
   else if (config->pattern == constant) {
     if (pattern_needs_init) {
       fill(phaseToColor(config->color_phase));
     }
     if (dimming) {
-    setBrightness(0xFF >> max_intensity - BACKLIGHT_DIMMED_INTENSITY - 1);
+    setBrightness(intensityToLevel(BACKLIGHT_DIMMED_INTENSITY));
     } else {
-    setBrightness(0xFF >> max_intensity - config->intensity - 1);
+    setBrightness(intensityToLevel(config->intensity));
     }
     show();
   }
@@ -82,8 +124,31 @@ void Backlights::loop() {
   else if (config->pattern == breath) {
     breathPattern();
   }
+  else if (config->pattern == program) {
+    programPattern();
+  }
+
+  rendered_generation = generation;
+}
 
-  pattern_needs_init = false;
+void Backlights::show() {
+  // Dithered only while fading, so a steady frame gives the same LED data and is skipped below.
+  uint8_t out[NUM_DIGITS * 3];
+  BacklightsOutputFrame(&output, frame, frame_level, NUM_DIGITS, out);
+  for (uint8_t digit = 0; digit < NUM_DIGITS; digit++) {
+    Adafruit_NeoPixel::setPixelColor(digit, out[digit * 3], out[digit * 3 + 1], out[digit * 3 + 2]);
+  }
+
+  // Adafruit_NeoPixel's own brightness is never changed, so its buffer is exactly what gets sent.
+  uint8_t *pixels = getPixels();
+  if (shown_valid && (memcmp(shown_pixels, pixels, sizeof(shown_pixels)) == 0)) {
+    metrics.recordLedShow(false);
+    return;
+  }
+  Adafruit_NeoPixel::show();
+  memcpy(shown_pixels, pixels, sizeof(shown_pixels));
+  shown_valid = true;
+  metrics.recordLedShow(true);
 }
 
 void Backlights::pulsePattern() {
@@ -91,10 +156,10 @@ void Backlights::pulsePattern() {
     fill(phaseToColor(config->color_phase));
   }
 
-  float pulse_length_millis = (60.0f * 1000) / config->breath_per_min;
-  float val = 1 + abs(sin(2 * M_PI * millis() / pulse_length_millis)) * 254;
+  uint16_t val = BacklightsPulse(phases.wave);
   if (dimming) {
     val = val * BACKLIGHT_DIMMED_INTENSITY / 7;
+    if (val < 1) val = 1;
   }  
   setBrightness((uint8_t)val);
 
@@ -108,9 +173,8 @@ void Backlights::breathPattern() {
   }
 
   // https://sean.voisen.org/blog/2011/10/breathing-led-with-arduino/
-  // Avoid a 0 value as it shuts off the LEDs and we have to re-initialize.
-  float pulse_length_millis = (60.0f * 1000) / config->breath_per_min;
-  float val = (exp(sin(2 * M_PI * millis() / pulse_length_millis)) - 0.36787944f) * 108.0f;
+  // Never completely dark.
+  uint16_t val = BacklightsBreath(phases.wave);
 
   if (dimming) {
     val = val * BACKLIGHT_DIMMED_INTENSITY / 7;
@@ -123,10 +187,10 @@ void Backlights::breathPattern() {
   show();
 }
 
-void Backlights::testPattern() {
+void Backlights::testPattern(uint32_t now_ms) {
   const uint8_t num_colors = 4;  // or 3 if you don't want black
   uint8_t num_states = NUM_DIGITS * num_colors;
-  uint8_t state = (millis()/test_ms_delay) % num_states;
+  uint8_t state = (now_ms/test_ms_delay) % num_states;
 
   uint8_t digit = state/num_colors;
   uint32_t color = 0xFF0000 >> (state%num_colors)*8;
@@ -169,22 +233,98 @@ void Backlights::rainbowPattern() {
   // TODO Make this /3 a parameter
   const uint16_t phase_per_digit = (max_phase/NUM_DIGITS)/3;
 
-  // Divide by 10 to slow down the rainbow rotation rate.
-  // TODO Make this /10 a parameter
-  uint16_t phase = millis()/16 % max_phase;  
-  
-  for (uint8_t digit=0; digit < NUM_DIGITS; digit++) {
-    // Shift the phase for this LED.
-    uint16_t my_phase = (phase + digit*phase_per_digit) % max_phase;
-    setPixelColor(digit, phaseToColor(my_phase));
+  // Rotation speed is set in BacklightsAdvancePhases().
+  uint16_t phase = phases.rainbow >> 8;
+
+  if (dimming) {
+    setBrightness(intensityToLevel(BACKLIGHT_DIMMED_INTENSITY));
+  }  else {
+    setBrightness(intensityToLevel(config->intensity));
+  }
+  bool recolor = (phase != rainbow_shown_phase) || pattern_needs_init;
+
+  if (recolor) {
+    for (uint8_t digit=0; digit < NUM_DIGITS; digit++) {
+      // Shift the phase for this LED.
+      uint16_t my_phase = (phase + digit*phase_per_digit) % max_phase;
+      setPixelColor(digit, phaseToColor(my_phase));
+    }
+    rainbow_shown_phase = phase;
+  }
+  show();
+}
+
+bool Backlights::loadProgram(const uint8_t *data, uint16_t length) {
+  if (!BacklightsIsValidProgram(data, length, BACKLIGHTS_PROGRAM_MAX_KEYS, NUM_DIGITS)) {
+    Serial.println("Invalid backlights program.");
+    return false;
+  }
+  xSemaphoreTake(program_mutex, portMAX_DELAY);
+  memcpy(program_data, data, length);
+  program_size = length;
+  xSemaphoreGive(program_mutex);
+  configChanged();  // start from the beginning
+  return true;
+}
+
+bool Backlights::loadProgramFile(const char *path) {
+  fs::File f = SPIFFS.open(path, "r");
+  if (!f) return false;
+  uint8_t data[program_max_size];
+  uint16_t length = f.read(data, sizeof(data));
+  bool too_long = f.available();
+  f.close();
+  if (too_long) return false;
+  Serial.print("Backlights program loaded from ");
+  Serial.println(path);
+  return loadProgram(data, length);
+}
+
+bool Backlights::saveProgramFile(const char *path) {
+  if (program_size == 0) return false;
+  fs::File f = SPIFFS.open(path, "w");
+  if (!f) return false;
+  // Only loop() changes the program, so no need to lock it for reading here.
+  bool ok = (f.write(program_data, program_size) == program_size);
+  f.close();
+  return ok;
+}
+
+// At most BACKLIGHTS_PROGRAM_MAX_KEYS * NUM_DIGITS steps per frame, whatever the program.
+void Backlights::programPattern() {
+  if (pattern_needs_init) {
+    phases.program_ms = 0;
   }
+  if (xSemaphoreTake(program_mutex, 0) != pdTRUE) {
+    return;  // being replaced right now; keep the last frame
+  }
+
   if (dimming) {
-    setBrightness(0xFF >> max_intensity - (uint8_t) BACKLIGHT_DIMMED_INTENSITY - 1);
+    setBrightness(intensityToLevel(BACKLIGHT_DIMMED_INTENSITY));
   }  else {
-    setBrightness(0xFF >> max_intensity - config->intensity - 1);  
+    setBrightness(intensityToLevel(config->intensity));  
   }
+
+  if (program_size == 0) {
+    phases.program_cycle_ms = 0;
+    clear();
+    xSemaphoreGive(program_mutex);
+    show();
+    return;
+  }
+
+  phases.program_cycle_ms = BacklightsProgramCycle(program_data);  // for the next BacklightsAdvancePhases()
+  uint32_t colors[NUM_DIGITS];
+  BacklightsProgramFrame(program_data, phases.program_ms, NUM_DIGITS, colors);
+  for (uint8_t digit = 0; digit < NUM_DIGITS; digit++) {
+    setPixelColor(digit, colors[digit]);
+  }
+  xSemaphoreGive(program_mutex);
   show();
 }
 
 const String Backlights::patterns_str[Backlights::num_patterns] = 
-  { "Dark", "Test", "Constant", "Rainbow", "Pulse", "Breath" };
+  { "Dark", "Test", "Constant", "Rainbow", "Pulse", "Breath", "Program" };
+
+// intensity_level[i] = round(255 * ((2^(i + 1) - 1) / 255)^(1 / 2.2))
+const uint8_t Backlights::intensity_level[8] = { 21, 34, 50, 70, 98, 135, 186, 255 };
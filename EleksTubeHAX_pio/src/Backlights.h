@@ -11,30 +11,76 @@
  * with the #defines in Hardware.h, so you can pass SECONDS_ONES directly
  * as the pixel index, no mapping required.
  * 
- * Otherwise, class Backlights behaves exactly as Adafruit_NeoPixel does.
+ * Otherwise, class Backlights behaves like Adafruit_NeoPixel does, except:
+ * - Colors and brightness are perceptual. show() converts them with a gamma table to 16 bit linear
+ *   light. While fading, temporal dithering turns that into 8 bit LED values that average out right
+ *   over a few frames; held steady, it is rounded. Integer only. Smooth fades even at the lowest intensity.
+ * - show() doesn't retransmit an unchanged frame.
+ *
+ * Frames are rendered by a task of their own, every BACKLIGHTS_FRAME_MS, so animations keep
+ * running while loop() is busy. The public methods only change the configuration; don't call
+ * the Adafruit_NeoPixel methods from outside once begin() started the task.
+ *
+ * The "Program" pattern plays keyframes loaded from SPIFFS or MQTT. Format, all little endian:
+ *   header, 6 bytes:  'K', version 1, number of keys (1..BACKLIGHTS_PROGRAM_MAX_KEYS), 0,
+ *                     uint16 cycle length in ms (0 = play once and hold the last keys)
+ *   key, 7 bytes:     uint16 time in ms (ascending, below the cycle length), LED bit mask
+ *                     (bit 0 = LED 0), red, green, blue, brightness
+ * Every LED fades linearly between the keys that include it, wrapping around when the program cycles.
  */
 #include <stdint.h>
 #include <math.h>
 #include "StoredConfig.h"
+#include "BacklightsMath.h"
 #include <Adafruit_NeoPixel.h>
 
 class Backlights: public Adafruit_NeoPixel {
 public:
   Backlights() : config(NULL), pattern_needs_init(true), off(true),
+    config_generation(1), rendered_generation(0), task_handle(NULL), frame_log_index(0),
+    program_size(0), program_mutex(NULL),
+    last_frame_ms(0), phases(), rainbow_shown_phase(0xFFFF),
+    frame(), frame_level(255), output(), shown_valid(false),
     Adafruit_NeoPixel(NUM_DIGITS, BACKLIGHTS_PIN, NEO_GRB + NEO_KHZ800)
     {}
 
-  enum patterns { dark, test, constant, rainbow, pulse, breath, num_patterns };
+  enum patterns { dark, test, constant, rainbow, pulse, breath, program, num_patterns };
   const static String patterns_str[num_patterns];
 
+  // Starts the render task.
   void begin(StoredConfig::Config::Backlights *config_);
-  void loop();
-
-  void togglePower() { off = !off; pattern_needs_init = true; }
-  void PowerOn()  { off = false; pattern_needs_init = true; }
-  void PowerOff() { off = true; pattern_needs_init = true; }
-
-  void setPattern(patterns p)      { config->pattern = uint8_t(p); pattern_needs_init = true; }
+  // Renders the frame for the given time. Integer only: the same sequence of times always gives the same frames.
+  // Called by the render task.
+  void loop(uint32_t now_ms);
+
+  // Start times (micros()) of the last frame_log_size frames, oldest first. For checking the frame rate jitter.
+  const static uint8_t frame_log_size = 32;
+  void getFrameTimes(uint32_t times[frame_log_size]);
+
+  // Keyframe program for the "Program" pattern. Returns false, keeping the old one, if data isn't a valid program.
+  const static uint8_t program_header_size = BACKLIGHTS_PROGRAM_HEADER_SIZE;
+  const static uint8_t program_key_size = BACKLIGHTS_PROGRAM_KEY_SIZE;
+  const static uint16_t program_max_size = program_header_size + BACKLIGHTS_PROGRAM_MAX_KEYS * program_key_size;
+  bool loadProgram(const uint8_t *data, uint16_t length);
+  bool loadProgramFile(const char *path);
+  bool saveProgramFile(const char *path);
+
+  // These hide the Adafruit_NeoPixel methods. The patterns draw into frame[], show() sends it
+  // through the gamma and dithering stage. It transmits only if the LED data changed since the
+  // last transmission: sending the same data again is invisible, but disables interrupts for ~200 us.
+  void setPixelColor(uint16_t n, uint32_t c)                        { if (n < NUM_DIGITS) frame[n] = c; }
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)   { setPixelColor(n, Color(r, g, b)); }
+  void fill(uint32_t c)                       { for (uint8_t i = 0; i < NUM_DIGITS; i++) frame[i] = c; }
+  void clear()                                { fill(0); }
+  void setBrightness(uint8_t level)           { frame_level = level; }
+  uint8_t getBrightness()                     { return frame_level; }
+  void show();
+
+  void togglePower() { off = !off; configChanged(); }
+  void PowerOn()  { off = false; configChanged(); }
+  void PowerOff() { off = true; configChanged(); }
+
+  void setPattern(patterns p)      { config->pattern = uint8_t(p); configChanged(); }
   patterns getPattern()            { return patterns(config->pattern); }
   String getPatternStr()           { return patterns_str[config->pattern]; }
   void setNextPattern(int8_t i=1);
@@ -46,7 +92,7 @@ public:
   void setBreathRate(uint8_t per_min)         { config->breath_per_min = per_min; }
   
   // Used by all constant color patterns.
-  void setColorPhase(uint16_t phase)          { config->color_phase = phase % max_phase; pattern_needs_init = true; }
+  void setColorPhase(uint16_t phase)          { config->color_phase = phase % max_phase; configChanged(); }
   void adjustColorPhase(int16_t adj);
   uint16_t getColorPhase()                    { return config->color_phase; }
   uint32_t getColor()                         { return phaseToColor(config->color_phase); }
@@ -55,26 +101,62 @@ public:
   void adjustIntensity(int16_t adj);
   uint8_t getIntensity()                      { return config->intensity; }
 
-  bool dimming = false;
+  volatile bool dimming = false;
   
 private:
-  bool pattern_needs_init;
-  bool off;
+  bool pattern_needs_init;  // set by the render task for one frame, when config_generation changed
+  volatile bool off;
+
+  // Counts configuration changes, instead of a "needs init" flag the render task would have to clear:
+  // a change made while a frame is being rendered is then never lost.
+  volatile uint32_t config_generation;
+  uint32_t rendered_generation;
+  void configChanged()                        { config_generation++; }
+
+  TaskHandle_t task_handle;
+  static void renderTask(void *parameter);
+
+  // The program is replaced by loop() and played by the render task. No allocation, so it can't fragment the heap.
+  uint8_t program_data[program_max_size];
+  uint16_t program_size;
+  SemaphoreHandle_t program_mutex;
+  StaticSemaphore_t program_mutex_buffer;
+  uint32_t frame_log[frame_log_size];
+  uint8_t frame_log_index;
 
   // Pattern configs, get backed up.
   StoredConfig::Config::Backlights *config;
 
+  // Animation state
+  uint32_t last_frame_ms;
+  BacklightsPhases phases;
+  uint16_t rainbow_shown_phase;  // don't recolor the LEDs if the rainbow didn't move
+
+  // Frame being drawn, perceptual
+  uint32_t frame[NUM_DIGITS];
+  uint8_t frame_level;
+
+  // Output stage
+  const static uint8_t intensity_level[8];      // same light output per intensity step as the old 0xFF >> (7 - intensity)
+  BacklightsOutput output;
+  uint8_t intensityToLevel(uint8_t intensity) { return intensity_level[intensity & 7]; }
+
+  // What the LEDs show now
+  bool shown_valid;
+  uint8_t shown_pixels[NUM_DIGITS * 3];
+
   // Pattern methods
-  void testPattern();
+  void testPattern(uint32_t now_ms);
   void rainbowPattern();
   void pulsePattern();
   void breathPattern();
+  void programPattern();
 
   // Helper methods
   uint8_t phaseToIntensity(uint16_t phase);
   uint32_t phaseToColor(uint16_t phase);
 
-  const uint16_t max_phase = 768;   // 256 up, 256 down, 256 off
+  const uint16_t max_phase = BACKLIGHTS_COLOR_PHASES;
   const uint8_t max_intensity = 8;  // 0 to 7
   const uint32_t test_ms_delay = 250; 
 
@@ -0,0 +1,204 @@
+#include "BacklightsMath.h"
+#include <stddef.h>
+
+// Generated with:
+//   pulse_wave[i]  = int(1 + sin(pi * i / 256) * 254)
+//   breath_wave[i] = int((exp(sin(2 * pi * i / 256)) - 0.36787944) * 108)
+static const uint8_t pulse_wave[256] = {
+    1,   4,   7,  10,  13,  16,  19,  22,  25,  28,  32,  35,  38,  41,  44,  47,
+   50,  53,  56,  59,  62,  65,  68,  71,  74,  77,  80,  83,  86,  89,  92,  95,
+   98, 101, 103, 106, 109, 112, 115, 117, 120, 123, 126, 128, 131, 134, 136, 139,
+  142, 144, 147, 149, 152, 154, 157, 159, 162, 164, 166, 169, 171, 173, 176, 178,
+  180, 182, 184, 187, 189, 191, 193, 195, 197, 199, 201, 203, 205, 206, 208, 210,
+  212, 213, 215, 217, 218, 220, 222, 223, 225, 226, 227, 229, 230, 231, 233, 234,
+  235, 236, 237, 239, 240, 241, 242, 243, 244, 244, 245, 246, 247, 248, 248, 249,
+  250, 250, 251, 251, 252, 252, 253, 253, 253, 254, 254, 254, 254, 254, 254, 254,
+  255, 254, 254, 254, 254, 254, 254, 254, 253, 253, 253, 252, 252, 251, 251, 250,
+  250, 249, 248, 248, 247, 246, 245, 244, 244, 243, 242, 241, 240, 239, 237, 236,
+  235, 234, 233, 231, 230, 229, 227, 226, 225, 223, 222, 220, 218, 217, 215, 213,
+  212, 210, 208, 206, 205, 203, 201, 199, 197, 195, 193, 191, 189, 187, 184, 182,
+  180, 178, 176, 173, 171, 169, 166, 164, 162, 159, 157, 154, 152, 149, 147, 144,
+  142, 139, 136, 134, 131, 128, 126, 123, 120, 117, 115, 112, 109, 106, 103, 101,
+   98,  95,  92,  89,  86,  83,  80,  77,  74,  71,  68,  65,  62,  59,  56,  53,
+   50,  47,  44,  41,  38,  35,  32,  28,  25,  22,  19,  16,  13,  10,   7,   4,
+};
+
+static const uint8_t breath_wave[256] = {
+   68,  70,  73,  76,  79,  82,  85,  88,  91,  94,  97, 101, 104, 108, 111, 115,
+  118, 122, 125, 129, 133, 137, 140, 144, 148, 152, 156, 160, 163, 167, 171, 175,
+  179, 183, 186, 190, 194, 197, 201, 204, 208, 211, 214, 218, 221, 224, 226, 229,
+  232, 234, 237, 239, 241, 243, 245, 246, 248, 249, 250, 251, 252, 253, 253, 253,
+  253, 253, 253, 253, 252, 251, 250, 249, 248, 246, 245, 243, 241, 239, 237, 234,
+  232, 229, 226, 224, 221, 218, 214, 211, 208, 204, 201, 197, 194, 190, 186, 183,
+  179, 175, 171, 167, 163, 160, 156, 152, 148, 144, 140, 137, 133, 129, 125, 122,
+  118, 115, 111, 108, 104, 101,  97,  94,  91,  88,  85,  82,  79,  76,  73,  70,
+   68,  65,  63,  60,  58,  55,  53,  51,  49,  47,  44,  42,  41,  39,  37,  35,
+   33,  32,  30,  29,  27,  26,  24,  23,  22,  20,  19,  18,  17,  16,  15,  14,
+   13,  12,  11,  10,  10,   9,   8,   7,   7,   6,   6,   5,   4,   4,   4,   3,
+    3,   2,   2,   2,   1,   1,   1,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   2,   2,   2,
+    3,   3,   4,   4,   4,   5,   6,   6,   7,   7,   8,   9,  10,  10,  11,  12,
+   13,  14,  15,  16,  17,  18,  19,  20,  22,  23,  24,  26,  27,  29,  30,  32,
+   33,  35,  37,  39,  41,  42,  44,  47,  49,  51,  53,  55,  58,  60,  63,  65,
+};
+
+void BacklightsAdvancePhases(BacklightsPhases *phases, uint32_t elapsed_ms, uint8_t waves_per_min) {
+  // Step per ms is 2^32 / wave length in ms.
+  uint32_t wave_step = (uint32_t)(((uint64_t)waves_per_min << 32) / (60 * 1000));
+  phases->wave += wave_step * elapsed_ms;
+  // 1/16 phase per ms, the same speed as millis()/16 before.
+  phases->rainbow = (phases->rainbow + elapsed_ms * (256 / 16)) % (uint32_t(BACKLIGHTS_COLOR_PHASES) << 8);
+  phases->program_ms += elapsed_ms;
+  if (phases->program_cycle_ms > 0) {
+    phases->program_ms %= phases->program_cycle_ms;
+  } else if (phases->program_ms > 0xFFFF) {
+    phases->program_ms = 0xFFFF;  // played once: the last keys hold from here on
+  }
+}
+
+uint8_t BacklightsPulse(uint32_t wave_phase) {
+  // |sin| repeats every half wave, so the table only covers half a wave.
+  return pulse_wave[(wave_phase >> 23) & 0xFF];
+}
+
+uint8_t BacklightsBreath(uint32_t wave_phase) {
+  return breath_wave[wave_phase >> 24];
+}
+
+bool BacklightsIsValidProgram(const uint8_t *data, uint16_t length, uint8_t max_keys, uint8_t num_leds) {
+  if (length < BACKLIGHTS_PROGRAM_HEADER_SIZE || data[0] != 'K' || data[1] != 1) return false;
+  uint8_t keys = data[2];
+  if (keys < 1 || keys > max_keys || length != BACKLIGHTS_PROGRAM_HEADER_SIZE + keys * BACKLIGHTS_PROGRAM_KEY_SIZE) return false;
+  uint16_t cycle_ms = data[4] | (data[5] << 8);
+  uint16_t last_ms = 0;
+  for (uint8_t k = 0; k < keys; k++) {
+    const uint8_t *key = data + BACKLIGHTS_PROGRAM_HEADER_SIZE + k * BACKLIGHTS_PROGRAM_KEY_SIZE;
+    uint16_t key_ms = key[0] | (key[1] << 8);
+    if (key_ms < last_ms) return false;                      // not sorted
+    if (cycle_ms > 0 && key_ms >= cycle_ms) return false;    // beyond the end of the cycle
+    if (key[2] >= (1 << num_leds)) return false;             // LED that doesn't exist
+    last_ms = key_ms;
+  }
+  return true;
+}
+
+uint16_t BacklightsProgramCycle(const uint8_t *data) {
+  return data[4] | (data[5] << 8);
+}
+
+void BacklightsProgramFrame(const uint8_t *data, uint32_t time_ms, uint8_t num_leds, uint32_t *colors) {
+  uint8_t keys = data[2];
+  int32_t cycle_ms = BacklightsProgramCycle(data);
+  int32_t t = (cycle_ms > 0) ? int32_t(time_ms % cycle_ms) : int32_t(time_ms < 0xFFFF ? time_ms : 0xFFFF);
+
+  // One pass over the keys finds, per LED: the first and last key, and the keys just before and after t.
+  const uint8_t *first[BACKLIGHTS_PROGRAM_MAX_LEDS] = {}, *last[BACKLIGHTS_PROGRAM_MAX_LEDS] = {};
+  const uint8_t *before[BACKLIGHTS_PROGRAM_MAX_LEDS] = {}, *after[BACKLIGHTS_PROGRAM_MAX_LEDS] = {};
+  for (uint8_t k = 0; k < keys; k++) {
+    const uint8_t *key = data + BACKLIGHTS_PROGRAM_HEADER_SIZE + k * BACKLIGHTS_PROGRAM_KEY_SIZE;
+    int32_t key_ms = key[0] | (key[1] << 8);
+    for (uint8_t led = 0; led < num_leds; led++) {
+      if (!(key[2] & (1 << led))) continue;
+      if (first[led] == NULL) first[led] = key;
+      last[led] = key;
+      if (key_ms <= t) before[led] = key;
+      else if (after[led] == NULL) after[led] = key;
+    }
+  }
+
+  for (uint8_t led = 0; led < num_leds; led++) {
+    if (first[led] == NULL) {
+      colors[led] = 0;  // not in any key
+      continue;
+    }
+    const uint8_t *a = before[led], *b = after[led];
+    int32_t a_ms = 0, b_ms = 0;
+    if (a != NULL) a_ms = a[0] | (a[1] << 8);
+    if (b != NULL) b_ms = b[0] | (b[1] << 8);
+    if (cycle_ms > 0) {
+      // Wrap around: before the first key comes the last one of the previous cycle, and the other way round.
+      if (a == NULL) { a = last[led];  a_ms = (a[0] | (a[1] << 8)) - cycle_ms; }
+      if (b == NULL) { b = first[led]; b_ms = (b[0] | (b[1] << 8)) + cycle_ms; }
+    }
+    else {
+      // Played once: hold the first key until it is reached, and the last one after it.
+      if (a == NULL) { a = b; a_ms = b_ms; }
+      if (b == NULL) { b = a; b_ms = a_ms; }
+    }
+
+    // Fraction of the way from a to b, 0..256
+    int32_t f = (b_ms > a_ms) ? ((t - a_ms) * 256) / (b_ms - a_ms) : 0;
+    uint32_t color = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+      int32_t from = a[3 + i] * a[6] / 255;
+      int32_t to = b[3 + i] * b[6] / 255;
+      color = (color << 8) | uint8_t(from + ((to - from) * f) / 256);
+    }
+    colors[led] = color;
+  }
+}
+
+// Half an LED step. Anything darker, but not off, is raised to it: dithering less would flicker visibly,
+// and rounding it to 0 would turn the low end of a fade dark (gamma16[v] < dither_min for v <= 14).
+static const uint16_t dither_min = 128;
+
+// (color * level)^gamma == color^gamma * level^gamma, so both go through the table separately:
+// no precision is lost at low levels.
+static uint32_t linearLight(uint8_t value, uint8_t level) {
+  uint32_t linear16 = (uint32_t(BacklightsGamma16[value]) * BacklightsGamma16[level]) >> 16;
+  return (linear16 < dither_min) ? dither_min : linear16;
+}
+
+uint8_t BacklightsDither(uint8_t value, uint8_t level, uint8_t *residual) {
+  if (value == 0 || level == 0) {
+    *residual = 0;
+    return 0;
+  }
+  uint32_t sum = linearLight(value, level) + *residual;
+  *residual = sum & 0xFF;
+  return (sum >> 8) > 255 ? 255 : (sum >> 8);
+}
+
+uint8_t BacklightsRound(uint8_t value, uint8_t level) {
+  if (value == 0 || level == 0) return 0;
+  uint32_t rounded = (linearLight(value, level) + 128) >> 8;
+  return rounded > 255 ? 255 : rounded;
+}
+
+void BacklightsOutputFrame(BacklightsOutput *output, const uint32_t *colors, uint8_t level, uint8_t num_leds, uint8_t *rgb) {
+  for (uint8_t led = 0; led < num_leds; led++) {
+    bool steady = (colors[led] == output->last_colors[led]) && (level == output->last_level);
+    for (uint8_t i = 0; i < 3; i++) {
+      uint8_t value = colors[led] >> (16 - 8 * i);  // r, g, b
+      uint8_t *residual = &output->residual[led * 3 + i];
+      if (steady) {
+        *residual = 0;
+        rgb[led * 3 + i] = BacklightsRound(value, level);
+      } else {
+        rgb[led * 3 + i] = BacklightsDither(value, level, residual);
+      }
+    }
+    output->last_colors[led] = colors[led];
+  }
+  output->last_level = level;
+}
+
+// gamma16[i] = round(65535 * (i / 255)^2.2)
+const uint16_t BacklightsGamma16[256] = {
+      0,     0,     2,     4,     7,    11,    17,    24,    32,    42,    53,    65,    79,    94,   111,   129,
+    148,   169,   192,   216,   242,   270,   299,   330,   362,   396,   432,   469,   508,   549,   591,   635,
+    681,   729,   779,   830,   883,   938,   995,  1053,  1113,  1175,  1239,  1305,  1373,  1443,  1514,  1587,
+   1663,  1740,  1819,  1900,  1983,  2068,  2155,  2243,  2334,  2427,  2521,  2618,  2717,  2817,  2920,  3024,
+   3131,  3240,  3350,  3463,  3578,  3694,  3813,  3934,  4057,  4182,  4309,  4438,  4570,  4703,  4838,  4976,
+   5115,  5257,  5401,  5547,  5695,  5845,  5998,  6152,  6309,  6468,  6629,  6792,  6957,  7124,  7294,  7466,
+   7640,  7816,  7994,  8175,  8358,  8543,  8730,  8919,  9111,  9305,  9501,  9699,  9900, 10102, 10307, 10515,
+  10724, 10936, 11150, 11366, 11585, 11806, 12029, 12254, 12482, 12712, 12944, 13179, 13416, 13655, 13896, 14140,
+  14386, 14635, 14885, 15138, 15394, 15652, 15912, 16174, 16439, 16706, 16975, 17247, 17521, 17798, 18077, 18358,
+  18642, 18928, 19216, 19507, 19800, 20095, 20393, 20694, 20996, 21301, 21609, 21919, 22231, 22546, 22863, 23182,
+  23504, 23829, 24156, 24485, 24817, 25151, 25487, 25826, 26168, 26512, 26858, 27207, 27558, 27912, 28268, 28627,
+  28988, 29351, 29717, 30086, 30457, 30830, 31206, 31585, 31966, 32349, 32735, 33124, 33514, 33908, 34304, 34702,
+  35103, 35507, 35913, 36321, 36732, 37146, 37562, 37981, 38402, 38825, 39252, 39680, 40112, 40546, 40982, 41421,
+  41862, 42306, 42753, 43202, 43654, 44108, 44565, 45025, 45487, 45951, 46418, 46888, 47360, 47835, 48313, 48793,
+  49275, 49761, 50249, 50739, 51232, 51728, 52226, 52727, 53230, 53736, 54245, 54756, 55270, 55787, 56306, 56828,
+  57352, 57879, 58409, 58941, 59476, 60014, 60554, 61097, 61642, 62190, 62741, 63295, 63851, 64410, 64971, 65535,
+};
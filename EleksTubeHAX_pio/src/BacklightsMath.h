@@ -0,0 +1,58 @@
+#ifndef BACKLIGHTS_MATH_H_
+#define BACKLIGHTS_MATH_H_
+
+/*
+ * The arithmetic of class Backlights: animation phases and waveforms, keyframe program playback and the
+ * gamma and dithering output stage.
+ * Integer only. No Arduino dependencies, so it is unit tested on the host (test/test_backlights).
+ */
+
+#include <stdint.h>
+
+#define BACKLIGHTS_COLOR_PHASES  768  // 256 up, 256 down, 256 off
+
+// Animation state. Advanced by the elapsed time of every frame, so a late frame catches up instead of slowing down.
+struct BacklightsPhases {
+  uint32_t wave;              // pulse and breath: one full wave = 2^32, wraps around by itself
+  uint32_t rainbow;           // 1/256 of a color phase, wraps at BACKLIGHTS_COLOR_PHASES << 8
+  uint32_t program_ms;        // time into the program, kept below the cycle length: millis() wraps after 49 days
+  uint16_t program_cycle_ms;  // of the program playing, 0 if it plays once
+};
+// Pulse and breath run at waves_per_min, the rainbow at 1/16 color phase per ms.
+void BacklightsAdvancePhases(BacklightsPhases *phases, uint32_t elapsed_ms, uint8_t waves_per_min);
+// Brightness along the wave, from precomputed 256 step tables.
+uint8_t BacklightsPulse(uint32_t wave_phase);   // 1 + |sin| * 254: two pulses per wave, never dark
+uint8_t BacklightsBreath(uint32_t wave_phase);  // (exp(sin) - 1/e) * 108: 0..253
+
+// Program format, see Backlights.h
+#define BACKLIGHTS_PROGRAM_HEADER_SIZE  6
+#define BACKLIGHTS_PROGRAM_KEY_SIZE     7
+#define BACKLIGHTS_PROGRAM_MAX_LEDS     8   // one bit each in the key's LED mask
+
+bool BacklightsIsValidProgram(const uint8_t *data, uint16_t length, uint8_t max_keys, uint8_t num_leds);
+// Colors (0xRRGGBB, key brightness applied) of LEDs 0..num_leds-1, time_ms after the program started.
+// data must be a valid program. At most keys * num_leds steps, whatever the time.
+void BacklightsProgramFrame(const uint8_t *data, uint32_t time_ms, uint8_t num_leds, uint32_t *colors);
+uint16_t BacklightsProgramCycle(const uint8_t *data);
+
+// Perceptual 8 bit -> linear 16 bit, gamma 2.2
+extern const uint16_t BacklightsGamma16[256];
+// Output stage of one color channel: perceptual value at perceptual level -> LED value. The part below
+// 8 bits is carried in *residual to the next frame, so the average over some frames is exact.
+// Non-zero value and level never give a dark LED, however small their product.
+uint8_t BacklightsDither(uint8_t value, uint8_t level, uint8_t *residual);
+// The same without dithering: the nearest LED value, also never dark.
+uint8_t BacklightsRound(uint8_t value, uint8_t level);
+
+// Output stage of all LEDs, up to BACKLIGHTS_PROGRAM_MAX_LEDS.
+struct BacklightsOutput {
+  uint32_t last_colors[BACKLIGHTS_PROGRAM_MAX_LEDS];
+  uint8_t last_level;
+  uint8_t residual[BACKLIGHTS_PROGRAM_MAX_LEDS * 3];  // the part below 8 bits, carried to the next frame
+};
+// Colors (0xRRGGBB) at level -> LED values, r, g, b for every LED. A LED is only dithered in frames where
+// its color or the level changed, i.e. while fading. Held steady, it gets BacklightsRound(): its LED data
+// doesn't change from frame to frame, so it needn't be sent again, and no low bit toggles visibly.
+void BacklightsOutputFrame(BacklightsOutput *output, const uint32_t *colors, uint8_t level, uint8_t num_leds, uint8_t *rgb);
+
+#endif /* BACKLIGHTS_MATH_H_ */
@@ -17,11 +17,113 @@ void Button::begin() {
   } else {
     button_state = idle;
   }
+  raw_down = down_last_time;
+  level_down = down_last_time;
+  debounced_down = down_last_time;
+
+#ifndef BUTTONS_POLLED
+  attachInterruptArg(digitalPinToInterrupt(bpin), edgeInterruptRoutine, this, CHANGE);
+#endif
+}
+
+void IRAM_ATTR Button::edgeInterruptRoutine(void *arg) {
+  Button *button = (Button *)arg;
+  // Read the level instead of trusting the edge: GPIO36 and GPIO39 get spurious interrupts
+  // while WiFi is in power save (ESP32 errata 3.11). Those don't change the level and are dropped here.
+  button->pushEdge(digitalRead(button->bpin) == button->active_state, millis());
+}
+
+void IRAM_ATTR Button::pushEdge(bool down, uint32_t ms) {
+  if (down == raw_down) return;
+  uint8_t next = (edge_head + 1) % edge_queue_size;
+  if (next == edge_tail) {
+    edge_overflow = true;
+    return;
+  }
+  edges[edge_head].ms = ms;
+  edges[edge_head].down = down;
+  edge_head = next;  // publish after the data is written
+  raw_down = down;
+}
+
+void Button::debounce() {
+  uint32_t now = millis_at_last_loop;
+  if (edge_overflow) {
+    // Lost some edges; the pin level is what counts.
+    edge_tail = edge_head;
+    edge_overflow = false;
+    raw_down = isButtonDown();
+    processEdge(raw_down, now);
+  }
+  while (edge_tail != edge_head) {
+    Edge e = edges[edge_tail];
+    edge_tail = (edge_tail + 1) % edge_queue_size;
+    processEdge(e.down, e.ms);
+  }
+  settle(now);
+}
+
+void Button::processEdge(bool down, uint32_t ms) {
+  settle(ms);
+  level_down = down;
+  if (!settling && (down != debounced_down)) {
+    acceptEdge(down, ms);
+  }
+  // else: no change, or a bounce within BUTTON_DEBOUNCE_MS of the accepted edge
+}
+
+// Ends the ignoring once BUTTON_DEBOUNCE_MS are over at ms. Signed: an edge may have come in after
+// millis_at_last_loop was taken. A loop: the edge accepted here may be over by ms too.
+void Button::settle(uint32_t ms) {
+  while (settling && (int32_t(ms - settle_ms) >= BUTTON_DEBOUNCE_MS)) {
+    settling = false;
+    if (level_down != debounced_down) {
+      acceptEdge(level_down, settle_ms + BUTTON_DEBOUNCE_MS);  // it didn't bounce back
+    }
+  }
+}
+
+void Button::acceptEdge(bool down, uint32_t ms) {
+  commitEdge(down, ms);
+  settling = true;
+  settle_ms = ms;
+}
+
+void Button::commitEdge(bool down, uint32_t ms) {
+  if (down == debounced_down) return;
+  debounced_down = down;
+  uint8_t next = (press_head + 1) % press_queue_size;
+  if (next == press_tail) return;      // state machine is far behind; loop() resyncs with debounced_down
+  presses[press_head].ms = ms;
+  presses[press_head].down = down;
+  press_head = next;
+}
+
+// Down and up, as if both edges had been debounced at ms. loop() shows them as down_edge and up_edge.
+void Button::injectPress(uint32_t ms) {
+  commitEdge(true, ms);
+  commitEdge(false, ms);
 }
 
 void Button::loop() {
   millis_at_last_loop = millis();
-  bool down_now = isButtonDown();
+#ifdef BUTTONS_POLLED
+  pushEdge(isButtonDown(), millis_at_last_loop);
+#endif
+  debounce();
+
+  // One debounced edge per call, so every state is seen by the code calling loop().
+  bool down_now = down_last_time;
+  uint32_t millis_at_edge = millis_at_last_loop;
+  if (press_tail != press_head) {
+    down_now = presses[press_tail].down;
+    millis_at_edge = presses[press_tail].ms;
+    press_tail = (press_tail + 1) % press_queue_size;
+  }
+  else if (debounced_down != down_last_time) {
+    // Dropped edge: resync with the debounced level.
+    down_now = debounced_down;
+  }
 
 #ifdef DEBUG_OUTPUT
   if (down_now) {
@@ -40,7 +142,7 @@ void Button::loop() {
   else if (down_last_time == false && down_now == true) {
     // Just pressed
     button_state = down_edge;
-    millis_at_last_transition = millis_at_last_loop;
+    millis_at_last_transition = millis_at_edge;
   } 
   else if (down_last_time == true && down_now == true) {
     // Been pressed. For how long?
@@ -72,7 +174,7 @@ void Button::loop() {
       // Just released from a short press.
       button_state = up_edge;
     }
-    millis_at_last_transition = millis_at_last_loop;
+    millis_at_last_transition = millis_at_edge;
   }
 
   state_changed = previous_state != button_state;
@@ -4,9 +4,11 @@
 #include "GLOBAL_DEFINES.h"
 
 /*
- * A simple class to keep track of button states.  It's asynchronous, only checking
- * for changes between calls to .loop().  If a button changes states multiple times 
- * between calls to .loop(), only the state when .loop() is called is registered.
+ * A simple class to keep track of button states.  A GPIO interrupt timestamps every edge into a
+ * small queue (single producer: the ISR, single consumer: loop()).  loop() debounces the edges and
+ * hands the resulting presses and releases to the state machine one at a time, so a short press
+ * between two calls of .loop() is not lost, and a long press is timed from the actual edge.
+ * With BUTTONS_POLLED, loop() samples the pin and feeds the same queue instead.
  */
 
 // For HIGH and LOW
@@ -16,7 +18,9 @@ class Button {
 public:
   Button(uint8_t bpin, uint8_t active_state=LOW, uint32_t long_press_ms=500)
     : bpin(bpin), active_state(active_state), long_press_ms(long_press_ms), 
-      down_last_time(false), state_changed(false), millis_at_last_transition(0), button_state(idle) {}
+      down_last_time(false), state_changed(false), millis_at_last_transition(0), button_state(idle),
+      edge_head(0), edge_tail(0), edge_overflow(false), raw_down(false),
+      level_down(false), settling(false), settle_ms(0), debounced_down(false), press_head(0), press_tail(0) {}
 
   /*
    * States:
@@ -50,8 +54,9 @@ public:
   state getState() { return button_state; }
   String getStateStr() { return state_str[button_state]; }
   bool stateChanged() { return state_changed; }
-  void setDownEdgeState() { button_state = down_edge; }
+  void injectPress(uint32_t ms);  // a short press from another input, e.g. the gesture sensor; call from loop() only
   uint32_t millisInState() { return millis_at_last_loop-millis_at_last_transition; }
+  uint32_t millisAtTransition() { return millis_at_last_transition; }  // time of the raw edge, before debouncing
 
   bool isIdle()         { return button_state == idle; }
   bool isDownEdge()     { return button_state == down_edge; }
@@ -78,6 +83,37 @@ private:
   state button_state;
 
   bool isButtonDown() { return digitalRead(bpin) == active_state; }
+
+  // Raw edges, written by the ISR
+  struct Edge {
+    uint32_t ms;
+    bool down;
+  };
+  const static uint8_t edge_queue_size = 16;
+  Edge edges[edge_queue_size];
+  volatile uint8_t edge_head;      // written by the ISR only
+  volatile uint8_t edge_tail;      // written by loop() only
+  volatile bool edge_overflow;     // bouncing filled the queue; loop() resyncs with the pin
+  volatile bool raw_down;          // last level put into the queue
+  static void IRAM_ATTR edgeInterruptRoutine(void *arg);
+  void IRAM_ATTR pushEdge(bool down, uint32_t ms);
+
+  // Debouncer, leading edge: an edge counts at once, the bounces in the BUTTON_DEBOUNCE_MS after it
+  // are ignored. If the level ended up different when that time is over, that counts as an edge then.
+  bool level_down;                 // after the last edge taken from the queue
+  bool settling;                   // ignoring edges since settle_ms
+  uint32_t settle_ms;
+  bool debounced_down;
+  void debounce();
+  void processEdge(bool down, uint32_t ms);
+  void settle(uint32_t ms);
+  void acceptEdge(bool down, uint32_t ms);
+  void commitEdge(bool down, uint32_t ms);
+
+  // Debounced presses and releases, waiting for the state machine
+  const static uint8_t press_queue_size = 4;
+  Edge presses[press_queue_size];
+  uint8_t press_head, press_tail;
 };
 
 
@@ -96,6 +132,14 @@ public:
     { left.loop(); mode.loop(); right.loop(); power.loop(); }
   bool stateChanged() 
     { return left.stateChanged() || mode.stateChanged() || right.stateChanged() || power.stateChanged(); }
+  // When the button that was just pressed went down, for input latency. 0 if no button was pressed in this loop.
+  uint32_t millisAtDownEdge() {
+    Button *all[] = { &left, &mode, &right, &power };
+    for (Button *b : all) {
+      if (b->isDownEdge()) return b->millisAtTransition();
+    }
+    return 0;
+  }
     
   // Just making them public, so we don't have to proxy everything.
   Button left, mode, right, power;
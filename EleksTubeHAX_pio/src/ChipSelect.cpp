@@ -1,4 +1,11 @@
 #include "ChipSelect.h"
+#include <soc/gpio_struct.h>
+
+// GPIO.out_w1ts/out_w1tc only reach GPIO0..31.
+static_assert(CSSR_DATA_PIN < 32 && CSSR_CLOCK_PIN < 32 && CSSR_LATCH_PIN < 32, "chip select shift register needs GPIOs below 32");
+const static uint32_t data_mask  = 1UL << CSSR_DATA_PIN;
+const static uint32_t clock_mask = 1UL << CSSR_CLOCK_PIN;
+const static uint32_t latch_mask = 1UL << CSSR_LATCH_PIN;
 
 void ChipSelect::begin() {
   pinMode(CSSR_LATCH_PIN, OUTPUT);
@@ -8,10 +15,13 @@ void ChipSelect::begin() {
   digitalWrite(CSSR_DATA_PIN, LOW);
   digitalWrite(CSSR_CLOCK_PIN, LOW);
   digitalWrite(CSSR_LATCH_PIN, LOW);
+  shifted_map = not_shifted;  // the register's content is unknown after power up or a display reinit
   update();
 }
 
 void ChipSelect::update() {
+  if (digits_map == shifted_map) return;
+
   // Documented in README.md.  Q7 and Q6 are unused. Q5 is Seconds Ones, Q0 is Hours Tens.
   // Q7 is the first bit written, Q0 is the last.  So we push two dummy bits, then start with
   // Seconds Ones and end with Hours Tens.
@@ -19,7 +29,18 @@ void ChipSelect::update() {
 
   uint8_t to_shift = (~digits_map) << 2;
 
-  digitalWrite(CSSR_LATCH_PIN, LOW);
-  shiftOut(CSSR_DATA_PIN, CSSR_CLOCK_PIN, LSBFIRST, to_shift);
-  digitalWrite(CSSR_LATCH_PIN, HIGH);
+  // One register write per edge. Each takes a few APB cycles, longer than the 74HC595 needs for
+  // setup time and clock pulse width at 3.3 V.
+  GPIO.out_w1tc = latch_mask;
+  for (uint8_t i = 0; i < 8; i++) {  // LSB first
+    if (to_shift & (1 << i)) {
+      GPIO.out_w1ts = data_mask;
+    } else {
+      GPIO.out_w1tc = data_mask;
+    }
+    GPIO.out_w1ts = clock_mask;
+    GPIO.out_w1tc = clock_mask;
+  }
+  GPIO.out_w1ts = latch_mask;
+  shifted_map = digits_map;
 }
@@ -5,11 +5,14 @@
 
 /*
  * `digit`s are as defined in Hardware.h, 0 == seconds ones, 5 == hours tens.
+ *
+ * update() is called for every digit drawn, so it is cheap: nothing happens if the map didn't change,
+ * otherwise the 74HC595 is clocked through the GPIO set/clear registers instead of shiftOut().
  */
 
 class ChipSelect {
 public:
-  ChipSelect() : digits_map(all_off) {}
+  ChipSelect() : digits_map(all_off), shifted_map(not_shifted) {}
 
   void begin();
   void update();
@@ -41,6 +44,8 @@ public:
 
 private:
   uint8_t digits_map;
+  uint8_t shifted_map;  // what the shift register holds
+  const static uint8_t not_shifted = 0xFF;  // never a valid map, forces the next update()
   const uint8_t all_on = 0x3F;
   const uint8_t all_off = 0x00;
 };
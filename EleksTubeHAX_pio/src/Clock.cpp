@@ -1,5 +1,7 @@
 #include "Clock.h"
 #include "WiFi_WPS.h"
+#include "Metrics.h"
+#include "RtcCache.h"
 
 #ifdef HARDWARE_SI_HAI_CLOCK // SI HAI IPS Clock XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
   // If it is a SI HAI Clock, use differnt RTC chip drivers
@@ -39,9 +41,7 @@
     uint32_t RtcGet() {
       RtcDateTime temptime;
       temptime = Rtc.GetDateTime();
-      uint32_t returnvalue = temptime.Unix32Time();
-      Serial.println(returnvalue);
-      return returnvalue;
+      return temptime.Unix32Time();
     }
 
     void RtcSet(uint32_t tt) {
@@ -52,7 +52,17 @@
 #else 
   // For the DS1307 RTC
   #include <DS1307RTC.h>
-    void RtcBegin() {}
+  #include <Wire.h>
+    void RtcBegin() {
+  #ifdef RTC_SQW_PIN
+      // DS3231 control register (0x0E): INTCN=0, RS2=RS1=0 -> 1 Hz square wave on INT/SQW pin.
+      Wire.begin();
+      Wire.beginTransmission(0x68);
+      Wire.write(0x0E);
+      Wire.write(0x00);
+      Wire.endTransmission();
+  #endif
+    }
     uint32_t RtcGet() {
       return RTC.get();
     }
@@ -62,6 +72,34 @@
 #endif 
 
 
+#ifdef RTC_SQW_PIN
+volatile uint32_t rtc_sqw_ticks = 0;
+
+void IRAM_ATTR RtcSqwInterruptRoutine() {
+  rtc_sqw_ticks++;
+}
+
+RtcCache rtc_cache(RtcGet, RtcSet, true, RTC_SQW_REREAD_EVERY_SEC);
+#else
+const uint32_t rtc_sqw_ticks = 0;
+RtcCache rtc_cache(RtcGet, RtcSet, false, RTC_REREAD_EVERY_SEC);
+#endif
+
+void RtcCacheBegin() {
+  RtcBegin();
+#ifdef RTC_SQW_PIN
+  pinMode(RTC_SQW_PIN, INPUT_PULLUP);  // open drain output on the RTC
+  // DS3231 updates the time registers on the falling edge of the 1 Hz output.
+  attachInterrupt(digitalPinToInterrupt(RTC_SQW_PIN), RtcSqwInterruptRoutine, FALLING);
+#endif
+  rtc_cache.invalidate();
+}
+
+uint32_t RtcGetCached()         { return rtc_cache.get(millis(), rtc_sqw_ticks); }
+uint32_t RtcGetFresh()          { return rtc_cache.getFresh(millis(), rtc_sqw_ticks); }
+void RtcSetCached(uint32_t tt)  { rtc_cache.set(tt, millis(), rtc_sqw_ticks); }
+
+
 
 void Clock::begin(StoredConfig::Config::Clock *config_) {
   config = config_;
@@ -77,11 +115,28 @@ void Clock::begin(StoredConfig::Config::Clock *config_) {
     config->is_valid = StoredConfig::valid;
   }
   
-  RtcBegin();
+#ifdef TIME_ZONE_POSIX
+  if (!time_zone.begin(TIME_ZONE_POSIX)) {
+    Serial.println("Invalid TIME_ZONE_POSIX string, using the stored UTC offset.");
+  }
+#endif
+
+  RtcCacheBegin();
   ntpTimeClient.begin();
-  ntpTimeClient.update();
-  Serial.print("NTP time = ");
-  Serial.println(ntpTimeClient.getFormattedTime());
+  if (WifiState == connected) {
+    ntpTimeClient.update();
+    Serial.print("NTP time = ");
+    Serial.println(ntpTimeClient.getFormattedTime());
+  }
+  else {
+    Serial.println("No WiFi yet, using RTC time until NTP is reachable.");
+  }
+  setSyncProvider(&Clock::syncProvider);
+}
+
+void Clock::requestNtpSync() {
+  millis_last_ntp = 0;
+  // Setting the provider again makes TimeLib call it right away.
   setSyncProvider(&Clock::syncProvider);
 }
 
@@ -91,6 +146,16 @@ void Clock::loop() {
   }
   else {
     loop_time = now();
+#ifdef TIME_ZONE_POSIX
+    if (time_zone.isValid()) {
+      // Cached inside TimeZone, only recalculated when a DST transition is passed.
+      int32_t offset = time_zone.getOffset(loop_time);
+      if (offset != time_zone_applied_offset) {
+        config->time_zone_offset = offset;
+        time_zone_applied_offset = offset;
+      }
+    }
+#endif
     local_time = loop_time + config->time_zone_offset;
     time_valid = true;
   }
@@ -98,45 +163,28 @@ void Clock::loop() {
 
 
 // Static methods used for sync provider to TimeLib library.
+// Called from inside now(), so keep it quiet: no serial output on this path.
 time_t Clock::syncProvider() {
-  Serial.println("syncProvider()");
-  time_t ntp_now, rtc_now;
-  rtc_now = RtcGet();
-
   if (millis() - millis_last_ntp > refresh_ntp_every_ms || millis_last_ntp == 0) {
     if (WifiState == connected) { 
       // It's time to get a new NTP sync
-      Serial.print("Getting NTP.");
 //      ntpTimeClient.forceUpdate();  // maybe this breaks the NTP requests as this should not be done more than every minute.
       if (ntpTimeClient.update()) {
-        Serial.print(".");
-        ntp_now = ntpTimeClient.getEpochTime();
-        Serial.println("NTP query done.");
-        Serial.print("NTP time = ");
-        Serial.println(ntpTimeClient.getFormattedTime());
+        time_t ntp_now = ntpTimeClient.getEpochTime();
 //      if (ntp_now > 1644601505) { //is it valid - reasonable number?
-          // Sync the RTC to NTP if needed.
-        Serial.println("NTP, RTC, Diff: ");
-        Serial.println(ntp_now);
-        Serial.println(rtc_now);
-        Serial.println(ntp_now-rtc_now);
-        if (ntp_now != rtc_now) {
-          RtcSet(ntp_now);
-          Serial.println("Updating RTC");
+        // Sync the RTC to NTP if needed. Compared with the RTC itself: the cache drifts with millis(),
+        // which is neither the RTC's error nor a reason to write it.
+        int32_t rtc_error = ntp_now - RtcGetFresh();
+        metrics.recordNtpOffset(rtc_error);
+        if (rtc_error != 0) {
+          RtcSetCached(ntp_now);
         }
         millis_last_ntp = millis();
-        Serial.println("Using NTP time.");
         return ntp_now;
-      } else {  // NTP valid
-      Serial.println("Invalid NTP response, using RTC time.");
-      return rtc_now;
-      }
+      } // Invalid NTP response, use RTC time.
     } // no wifi
-    Serial.println("No WiFi, using RTC time.");
-    return rtc_now;
   }
-  Serial.println("Using RTC time.");
-  return rtc_now;
+  return RtcGetCached();
 }
 
 uint8_t Clock::getHoursTens() {
@@ -9,6 +9,10 @@
 #include <WiFi.h>
 #include "NTPClient_AO.h"
 
+#ifdef TIME_ZONE_POSIX
+#include "TimeZone.h"
+#endif
+
 #include "StoredConfig.h"
 // For TFTs::blanked
 #include "TFTs.h"
@@ -17,13 +21,15 @@ class Clock {
 public:
   Clock() : loop_time(0), local_time(0), time_valid(false), config(NULL) {}
   
-  // The global WiFi from WiFi.h must already be .begin()'d before calling Clock::begin()
+  // WiFi doesn't have to be connected yet; the time comes from the RTC until it is.
   void begin(StoredConfig::Config::Clock *config_); 
   void loop();
 
   // Calls NTPClient::getEpochTime() or RTC::get() as appropriate
   // This has to be static to pass to TimeLib::setSyncProvider.
   static time_t syncProvider();
+  // Sync to NTP now instead of at the next hourly refresh, e.g. when WiFi just connected.
+  static void requestNtpSync();
 
   // Set preferred hour format. true = 12hr, false = 24hr
   void setTwelveHour(bool th)           { config->twelve_hour = th; }
@@ -86,6 +92,13 @@ private:
   bool time_valid;
   StoredConfig::Config::Clock *config;
 
+#ifdef TIME_ZONE_POSIX
+  // Offline DST rules. The offset they give is copied into config->time_zone_offset once per
+  // transition, so manual changes from the menu stay in effect until the next transition.
+  TimeZone time_zone;
+  int32_t time_zone_applied_offset = INT32_MIN;
+#endif
+
   // Static variables needed for syncProvider()
   static WiFiUDP ntpUDP;
   static NTPClient ntpTimeClient;
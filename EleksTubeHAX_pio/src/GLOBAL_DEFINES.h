@@ -19,10 +19,17 @@
   #define HARDWARE_Elekstube_CLOCK
 #endif
 
+#ifdef TIME_ZONE_POSIX
+  // DST is calculated on the clock from the time zone rules; no need for the geolocation lookup
+  #undef GEOLOCATION_ENABLED
+#endif
+
 // ************* Version Infomation  *************
 #define DEVICE_NAME       "IPS-clock"
 #define FIRMWARE_VERSION  "SmittyHalibut & aly-fly IPS clock v1.0"
 #define SAVED_CONFIG_NAMESPACE  "configs"
+#define CONFIG_SAVE_DELAY_SEC   10  // saveLater() writes the config once it stopped changing for this long...
+#define CONFIG_SAVE_MAX_DELAY_SEC  600  // ...or this long after the first change, whatever comes first
 
 
 // ************ WiFi advanced config *********************
@@ -30,11 +37,40 @@
 #define ESP_MANUFACTURER  "ESPRESSIF"
 #define ESP_MODEL_NUMBER  "ESP32"
 #define ESP_MODEL_NAME    "IPS clock"
+#define WIFI_FAST_CONNECT_TIMEOUT_MS  3000  // connecting to the cached AP (BSSID + channel, no scan); full scan after that
+
+
+// ************ Buttons config *********************
+#define BUTTON_DEBOUNCE_MS  20  // a press or release counts at once; edges within this time after it are bounces
+
+
+// ************ Backlights config *********************
+#define BACKLIGHTS_FRAME_MS  20  // LED animation frame period (50 fps), independent of loop()
+#define BACKLIGHTS_PROGRAM_MAX_KEYS  32  // keyframes in a "Program" pattern; bounds its cost per frame
+#define BACKLIGHTS_PROGRAM_FILE  "/backlights.kfp"  // loaded at start up; a program received over MQTT is saved here
 
 
 // ************ MQTT config *********************
-#define MQTT_RECONNECT_WAIT_SEC  30  // how long to wait between retries to connect to broker
+#define MQTT_RECONNECT_MIN_SEC  5    // wait before retrying to connect to broker; doubles with every failed attempt...
+#define MQTT_RECONNECT_MAX_SEC  300  // ...up to this
 #define MQTT_REPORT_STATUS_EVERY_SEC  71 // How often report status to MQTT Broker
+#define MQTT_PUBLISH_INTERVAL_MS  120  // minimum time between two published messages; queued messages are sent at this rate
+#define MQTT_QUEUE_LENGTH         10   // messages waiting to be published
+#define MQTT_QUEUE_TOPIC_SIZE     32   // topic, without the MQTT_CLIENT prefix
+#define MQTT_QUEUE_MESSAGE_SIZE   160  // fits status messages, report/state and report/temperatureHistory
+#define MQTT_METRICS_MESSAGE_SIZE 704  // one slot of this size, for the report/metrics JSON message
+#define MQTT_BUFFER_SIZE          768  // PubSubClient packet buffer: topic + message + header; fits a backlights program and the metrics
+#define MQTT_REPORT_METRICS_EVERY_SEC  300  // How often report performance metrics ("report/metrics"); 0 = never
+
+
+// ************ Geolocation config *********************
+#define GEOLOCATION_CACHE_TTL_HOURS  24  // stored result is used without a new query if it is younger than this
+#define GEOLOCATION_RETRY_MIN        15  // wait before retrying a failed query
+
+
+// ************ RTC config *********************
+#define RTC_REREAD_EVERY_SEC      3600  // how long the cached RTC time is extrapolated with millis() before the RTC is read again
+#define RTC_SQW_REREAD_EVERY_SEC  86400 // same, when the 1 Hz square wave (RTC_SQW_PIN) is counted
 
 
 // ************ Temperature config *********************
@@ -144,6 +180,7 @@
   #define BUTTON_MODE_PIN (GPIO_NUM_3)
   #define BUTTON_RIGHT_PIN (GPIO_NUM_3)
   #define BUTTON_POWER_PIN (GPIO_NUM_3)
+  #define BUTTONS_POLLED  // all four share a dummy pin (UART RX); no interrupts on it
   
   // Pins ADPS interupt
   #define GESTURE_SENSOR_INPUT_PIN (GPIO_NUM_5) // -> INTERRUPT
@@ -151,6 +188,7 @@
   // I2C to DS3231 RTC.
   #define RTC_SCL_PIN (22)
   #define RTC_SDA_PIN (21)
+  //#define RTC_SQW_PIN (xx)  // DS3231 INT/SQW output, if wired to the ESP32; 1 Hz ticks save reading the RTC over I2C
 
   // Chip Select shift register, to select the display
   #define CSSR_DATA_PIN (14)  
@@ -211,6 +249,7 @@
   // I2C to DS3231 RTC.
   #define RTC_SCL_PIN (22)
   #define RTC_SDA_PIN (21)
+  //#define RTC_SQW_PIN (xx)  // DS3231 INT/SQW output, if wired to the ESP32; 1 Hz ticks save reading the RTC over I2C
 
   // Chip Select shift register, to select the display
   #define CSSR_DATA_PIN (14)
@@ -270,6 +309,7 @@
   // I2C to DS3231 RTC.
   #define RTC_SCL_PIN (22)
   #define RTC_SDA_PIN (21)
+  //#define RTC_SQW_PIN (xx)  // DS3231 INT/SQW output, if wired to the ESP32; 1 Hz ticks save reading the RTC over I2C
 
   // Chip Select shift register, to select the display
   #define CSSR_DATA_PIN (14)
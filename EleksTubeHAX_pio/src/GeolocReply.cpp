@@ -0,0 +1,22 @@
+#include "GeolocReply.h"
+#include <stdio.h>
+
+void GeolocReplyFilter(JsonDocument &filter) {
+  filter["error"] = true;
+  JsonObject timezone = filter["timezone"].to<JsonObject>();
+  timezone["name"] = true;
+  timezone["gmt_offset"] = true;
+  timezone["current_time"] = true;
+  timezone["is_dst"] = true;
+}
+
+bool GeolocReadTimeZone(JsonDocument &doc, GeolocTimeZone *tz) {
+  if (!doc["error"].isNull()) return false;
+  JsonObject timezone = doc["timezone"];
+  if (timezone["gmt_offset"].isNull()) return false;
+  snprintf(tz->name, sizeof(tz->name), "%s", timezone["name"] | "");
+  snprintf(tz->current_time, sizeof(tz->current_time), "%s", timezone["current_time"] | "");
+  tz->offset = timezone["gmt_offset"];
+  tz->is_dst = timezone["is_dst"];
+  return true;
+}
@@ -0,0 +1,24 @@
+#ifndef GEOLOC_REPLY_H
+#define GEOLOC_REPLY_H
+
+/*
+ * The abstractapi.com geolocation reply. Only the time zone is used: the filter drops everything
+ * else while the reply streams in, so the body is never held in RAM.
+ * Needs nothing but ArduinoJson, so it is unit tested on the host (test/test_geoloc_reply).
+ */
+
+#include <ArduinoJson.h>
+
+struct GeolocTimeZone {
+  char name[48];          // e.g. "Europe/Ljubljana"
+  char current_time[12];  // "17:58:18"
+  double offset;          // hours from UTC, DST included
+  bool is_dst;
+};
+
+// For deserializeJson(doc, stream, DeserializationOption::Filter(filter)).
+void GeolocReplyFilter(JsonDocument &filter);
+// From the filtered reply. False for an error reply, or one without a time zone.
+bool GeolocReadTimeZone(JsonDocument &doc, GeolocTimeZone *tz);
+
+#endif // GEOLOC_REPLY_H
@@ -0,0 +1,99 @@
+#include "Gestures.h"
+
+#ifdef HARDWARE_NovelLife_SE_CLOCK
+#include "Metrics.h"
+
+void Gestures::begin() {
+  Serial.println("Gesture sensor start");
+  pinMode(GESTURE_SENSOR_INPUT_PIN, INPUT);
+
+  // Initialize gesture sensor APDS-9960 (configure I2C and initial values)
+  if (!apds.init()) {
+    Serial.println(F("Something went wrong during APDS-9960 init!"));
+    return;
+  }
+  Serial.println(F("APDS-9960 initialization complete"));
+
+  //Set Gain to 1x, bacause the cheap chinese fake APDS sensor can't handle more (also remember to extend ID check in Sparkfun libary to 0x3B!)
+  apds.setGestureGain(GGAIN_1X);
+
+  // Start running the APDS-9960 gesture sensor engine
+  if (!apds.enableGestureSensor(true)) {
+    Serial.println(F("Something went wrong during gesture sensor enablimg in the APDS-9960 library!"));
+    return;
+  }
+  Serial.println(F("Gesture sensor is now running"));
+
+  wake = xSemaphoreCreateBinaryStatic(&wake_buffer);
+  events = xQueueCreateStatic(event_queue_size, sizeof(Event), events_storage, &events_buffer);
+  TaskHandle_t task_handle;
+  if (xTaskCreate(readTask, "gestures", 3072, this, 2, &task_handle) != pdPASS) {
+    Serial.println("Gesture task failed to start.");
+    return;
+  }
+  metrics.registerTask(Metrics::task_gesture, task_handle);
+  attachInterruptArg(digitalPinToInterrupt(GESTURE_SENSOR_INPUT_PIN), interruptRoutine, this, FALLING);
+}
+
+void IRAM_ATTR Gestures::interruptRoutine(void *arg) {
+  Gestures *self = (Gestures *)arg;
+  self->millis_at_interrupt = millis();
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(self->wake, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// The RTC shares the I2C bus. Wire locks the bus per transaction, so reads from loop() and from here don't mix.
+void Gestures::readTask(void *parameter) {
+  Gestures *self = (Gestures *)parameter;
+  while (true) {
+    // The timeout catches an INT that was already low when the interrupt got attached; there's no falling edge then.
+    xSemaphoreTake(self->wake, pdMS_TO_TICKS(1000));
+    if (!self->apds.isGestureAvailable()) continue;
+
+    uint32_t start_us = micros();
+    int direction = self->apds.readGesture();
+    metrics.recordGestureRead((micros() - start_us) / 1000);
+
+    Event e = { (uint8_t)direction, self->millis_at_interrupt };
+    xQueueSend(self->events, &e, 0);  // loop() is far behind if the queue is full; drop the gesture
+  }
+}
+
+// Gestures are short presses of the matching button, in the same queue the button's debouncer uses.
+void Gestures::loop(Buttons &buttons) {
+  if (events == NULL) return;
+  Event e;
+  while (xQueueReceive(events, &e, 0) == pdTRUE) {
+    switch (e.direction) {
+      case DIR_UP:
+        buttons.left.injectPress(e.ms);
+        Serial.println("Gesture detected! LEFT");
+        break;
+      case DIR_DOWN:
+        buttons.right.injectPress(e.ms);
+        Serial.println("Gesture detected! RIGHT");
+        break;
+      case DIR_LEFT:
+        buttons.power.injectPress(e.ms);
+        Serial.println("Gesture detected! DOWN");
+        break;
+      case DIR_RIGHT:
+        buttons.mode.injectPress(e.ms);
+        Serial.println("Gesture detected! UP");
+        break;
+      case DIR_NEAR:
+        buttons.mode.injectPress(e.ms);
+        Serial.println("Gesture detected! NEAR");
+        break;
+      case DIR_FAR:
+        buttons.power.injectPress(e.ms);
+        Serial.println("Gesture detected! FAR");
+        break;
+      default:
+        Serial.println("Movement detected but NO gesture detected!");
+    }
+  }
+}
+
+#endif // HARDWARE_NovelLife_SE_CLOCK
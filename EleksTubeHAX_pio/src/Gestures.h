@@ -0,0 +1,48 @@
+#ifndef GESTURES_H
+#define GESTURES_H
+
+/*
+ * APDS-9960 gesture sensor of the NovelLife SE, which has no buttons.
+ *
+ * The sensor pulls its INT pin low when a gesture is in the FIFO. The interrupt only wakes a task,
+ * which reads the gesture over I2C. That read waits until the hand has left the sensor and takes
+ * tens of ms; the task sleeps during that time instead of loop().
+ * Gestures are handed to loop() through a queue and become short presses of the matching button.
+ */
+
+#include "GLOBAL_DEFINES.h"
+
+#ifdef HARDWARE_NovelLife_SE_CLOCK
+#include <SparkFun_APDS9960.h>
+#include "Buttons.h"
+
+class Gestures {
+public:
+  Gestures() : apds(), wake(NULL), events(NULL), millis_at_interrupt(0) {}
+
+  void begin();
+  // Call before buttons.loop(), so the press is seen in the same loop.
+  void loop(Buttons &buttons);
+
+private:
+  SparkFun_APDS9960 apds;
+
+  struct Event {
+    uint8_t direction;  // DIR_* of the APDS library
+    uint32_t ms;        // interrupt time
+  };
+  const static uint8_t event_queue_size = 4;
+
+  SemaphoreHandle_t wake;
+  StaticSemaphore_t wake_buffer;
+  QueueHandle_t events;
+  StaticQueue_t events_buffer;
+  uint8_t events_storage[event_queue_size * sizeof(Event)];
+  volatile uint32_t millis_at_interrupt;
+
+  static void IRAM_ATTR interruptRoutine(void *arg);
+  static void readTask(void *parameter);
+};
+
+#endif // HARDWARE_NovelLife_SE_CLOCK
+#endif // GESTURES_H
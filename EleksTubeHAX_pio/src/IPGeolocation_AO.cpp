@@ -11,6 +11,8 @@
 #include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include "IPGeolocation_AO.h"
+#include "GeolocReply.h"
+#include "Metrics.h"
 
 IPGeolocation::IPGeolocation(String Key){
   _Key = Key;
@@ -21,10 +23,6 @@ IPGeolocation::IPGeolocation(String Key, String API){
   _API = API;
 }
 
-String IPGeolocation::getResponse(){
-  return _Response;
-}
-
 bool IPGeolocation::updateStatus(IPGeo *I){
   if(_API == "ABSTRACT"){
 
@@ -36,6 +34,8 @@ bool IPGeolocation::updateStatus(IPGeo *I){
     httpsClient.setInsecure(); //skip verification
     httpsClient.setTimeout(GEO_CONN_TIMEOUT_SEC * 1000); // 15 Seconds
 
+    uint32_t HeapBeforeRequest = ESP.getFreeHeap();
+
     DEBUGPRINT("HTTPS Connecting");
     int r=0; //retry counter
     while((!httpsClient.connect(host, httpsPort)) && (r < 10)){
@@ -49,66 +49,40 @@ bool IPGeolocation::updateStatus(IPGeo *I){
     } else {
       DEBUGPRINT("Connected.");      
     }
+    uint32_t HeapConnected = ESP.getFreeHeap();  // TLS session buffers are allocated by now
 
     String Link = String("https://") + host + "/v1/?api_key=" + _Key;
 
     DEBUGPRINT("requesting URL: ");
     DEBUGPRINT(String("GET ") + Link + " HTTP/1.0");
-    httpsClient.println(String("GET ") + Link + " HTTP/1.1");
+    httpsClient.println(String("GET ") + Link + " HTTP/1.0");
     httpsClient.println(String("Host: ") + host);
     httpsClient.println(String("Connection: close"));
     httpsClient.println();
 
     DEBUGPRINT("Request sent, waiting for response");
 
-//    DEBUGPRINT("headers:");
-    uint32_t StartTime = millis();
-    bool response_ok = false;
-//    String _Response; // use private var
-    while (httpsClient.connected()) {
-      _Response = httpsClient.readStringUntil('\n');
-//      DEBUGPRINT(_Response);
-      if (_Response == "\r") {
-        DEBUGPRINT("headers received");
-        response_ok = true;
-        break;
-      }
-      if (millis() - StartTime > GEO_CONN_TIMEOUT_SEC * 1000) {
-        response_ok = false;
-        break;
-        }
-    }
-    if (!response_ok) {
+    // Skip the headers. Request is HTTP/1.0, so the body is never chunked and can be parsed straight from the stream.
+    if (!httpsClient.find("\r\n\r\n")) {
         DEBUGPRINT("Error reading header data from server.");
         return false;
       }
-      
-    DEBUGPRINT("reply:");
-    StartTime = millis();
-    response_ok = false;
-    while(httpsClient.connected()){
-      _Response = httpsClient.readString();
-      DEBUGPRINT(_Response); //Print response
-      response_ok = true;
-//      break;
-    if (millis() - StartTime > GEO_CONN_TIMEOUT_SEC * 1000) {
-      response_ok = false;
-      break;
-      }
-    }
-    if (!response_ok) {
-        DEBUGPRINT("Error reading json data from server.");
-        return false;
-      }
+    DEBUGPRINT("headers received");
 
-
-    
+    // Parse the reply directly from the stream, keeping only the fields we use. No copy of the body in RAM.
+    JsonDocument filter;
+    GeolocReplyFilter(filter);
     JsonDocument doc;
-    deserializeJson(doc, _Response);
+    DeserializationError error = deserializeJson(doc, httpsClient, DeserializationOption::Filter(filter));
+    uint32_t HeapWithDoc = ESP.getFreeHeap();
+    httpsClient.stop();
 
-    // catch errors:
-    if (_Response.indexOf("error") > 0) {    
-      DEBUGPRINT("IP Geoloc ERROR!");
+    // Lowest of the samples: with the TLS session and the parsed reply both allocated.
+    metrics.recordGeolocHeap(HeapConnected < HeapWithDoc ? HeapConnected : HeapWithDoc);
+    DEBUGPRINT(String("Geo heap: free before request ") + HeapBeforeRequest + ", connected " + HeapConnected + ", with parsed reply " + HeapWithDoc);
+
+    if (error) {
+      DEBUGPRINT(String("Error parsing json data from server: ") + error.c_str());
       return false;
     }
     
@@ -163,17 +137,16 @@ summer time:
 "connection":{"autonomous_system_number":34779,"autonomous_system_organization":"xxxx","connection_type":"Cellular","isp_name":"xxxxx","organization_name":null}}
 */
 
-    JsonObject timezone = doc["timezone"];
+    GeolocTimeZone tz;
+    if (!GeolocReadTimeZone(doc, &tz)) {
+      DEBUGPRINT("IP Geoloc ERROR, or no time zone in the reply!");
+      return false;
+    }
     
-    I->tz = timezone["name"].as<String>();
-    I->is_dst = timezone["is_dst"];
-    I->offset= timezone["gmt_offset"];
-    I->current_time= timezone["current_time"].as<String>();    
-    I->country = doc["country"].as<String>();
-    I->country_code = doc["country_code"].as<String>();
-    I->city = doc["city"].as<String>();
-    I->latitude = doc["latitude"];
-    I->longitude = doc["longitude"];
+    I->tz = tz.name;
+    I->is_dst = tz.is_dst;
+    I->offset = tz.offset;
+    I->current_time = tz.current_time;
 
     DEBUGPRINT("Geo Time Zone: ");
     DEBUGPRINT(I->tz);
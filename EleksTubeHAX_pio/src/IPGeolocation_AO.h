@@ -21,16 +21,12 @@
 
 #include "Arduino.h"
 
+// Only the time zone is parsed from the reply, everything else is filtered out while streaming.
 struct IPGeo {
   String tz;
   double offset;
   bool is_dst;
   String current_time;
-  String city;
-  String country;
-  String country_code;
-  double latitude;
-  double longitude;
 };
 
 class IPGeolocation
@@ -39,10 +35,8 @@ class IPGeolocation
     IPGeolocation(String Key);
     IPGeolocation(String Key, String API); // Use IPG for api.ipgeolocation.io and ABSTRACT for app.abstractapi.com/api/ip-geolocation
     bool updateStatus(IPGeo *I);
-    String getResponse();
   private:
     String _Key;
-    String _Response;
     String _API;
 };
 
@@ -0,0 +1,91 @@
+#include "Metrics.h"
+#include "Mqtt_client_ips.h"
+#include <esp_heap_caps.h>
+
+const uint16_t Metrics::loop_bucket_ms[Metrics::loop_buckets - 1] = { 2, 5, 10, 20, 50, 100, 500 };
+const uint16_t Metrics::latency_bucket_ms[Metrics::latency_buckets - 1] = { 10, 20, 30, 50, 100 };
+
+void Metrics::reset() {
+  loop_count = loop_sum_ms = loop_max_ms = 0;
+  memset(loop_histogram, 0, sizeof(loop_histogram));
+  draw_count = draw_sum_ms = draw_max_ms = 0;
+  image_hits = image_misses = 0;
+  led_transmits = led_skips = 0;
+  led_jitter_us = 0;
+  latency_max_ms = 0;
+  memset(latency_histogram, 0, sizeof(latency_histogram));
+  gesture_reads = gesture_max_ms = 0;
+}
+
+void Metrics::recordLoopTime(uint32_t ms) {
+  loop_count++;
+  loop_sum_ms += ms;
+  if (ms > loop_max_ms) loop_max_ms = ms;
+  uint8_t bucket = 0;
+  while (bucket < loop_buckets - 1 && ms >= loop_bucket_ms[bucket]) bucket++;
+  loop_histogram[bucket]++;
+}
+
+void Metrics::recordDrawTime(uint32_t ms, bool image_was_cached) {
+  draw_count++;
+  draw_sum_ms += ms;
+  if (ms > draw_max_ms) draw_max_ms = ms;
+  if (image_was_cached) image_hits++; else image_misses++;
+}
+
+// Called from the backlights task; a frame recorded during report() may get lost, which is fine.
+void Metrics::recordLedFrame(uint32_t interval_us) {
+  uint32_t period_us = BACKLIGHTS_FRAME_MS * 1000;
+  uint32_t jitter_us = (interval_us > period_us) ? interval_us - period_us : period_us - interval_us;
+  if (jitter_us > led_jitter_us) led_jitter_us = jitter_us;
+}
+
+void Metrics::recordInputLatency(uint32_t ms) {
+  if (ms > latency_max_ms) latency_max_ms = ms;
+  uint8_t bucket = 0;
+  while (bucket < latency_buckets - 1 && ms >= latency_bucket_ms[bucket]) bucket++;
+  latency_histogram[bucket]++;
+}
+
+void Metrics::registerTask(Task task, TaskHandle_t handle) {
+  portENTER_CRITICAL(&task_lock);
+  task_handles[task] = handle;
+  portEXIT_CRITICAL(&task_lock);
+}
+
+void Metrics::recordTaskExit(Task task) {
+  portENTER_CRITICAL(&task_lock);
+  task_handles[task] = NULL;
+  task_stack[task] = uxTaskGetStackHighWaterMark(NULL);
+  portEXIT_CRITICAL(&task_lock);
+}
+
+int Metrics::report(char *buf, size_t size) {
+  portENTER_CRITICAL(&task_lock);
+  for (uint8_t i = 0; i < task_count; i++) {
+    if (task_handles[i] != NULL) task_stack[i] = uxTaskGetStackHighWaterMark(task_handles[i]);
+  }
+  portEXIT_CRITICAL(&task_lock);
+
+  int len = snprintf(buf, size,
+    "{\"loop_avg\":%u,\"loop_max\":%u,\"loop_hist\":[%u,%u,%u,%u,%u,%u,%u,%u],"
+    "\"heap\":%u,\"heap_block\":%u,\"heap_min\":%u,\"stack\":%u,"
+    "\"stack_mqtt\":%u,\"stack_geoloc\":%u,\"stack_leds\":%u,\"stack_gesture\":%u,\"stack_temp\":%u,"
+    "\"draw_avg\":%u,\"draw_max\":%u,\"img_hit\":%u,\"img_miss\":%u,\"led_tx\":%u,\"led_skip\":%u,\"led_jitter_us\":%u,"
+    "\"input_max\":%u,\"input_hist\":[%u,%u,%u,%u,%u,%u],\"gesture_n\":%u,\"gesture_max\":%u,"
+    "\"ntp_offset\":%d,\"ntp_syncs\":%u,\"mqtt\":%d,\"mqtt_fail\":%u,\"boot_ms\":%u,"
+    "\"wifi_ms\":%u,\"wifi_fast\":%d,\"cfg_writes\":%u,\"geo_heap\":%u}",
+    loop_count ? loop_sum_ms / loop_count : 0, loop_max_ms,
+    loop_histogram[0], loop_histogram[1], loop_histogram[2], loop_histogram[3],
+    loop_histogram[4], loop_histogram[5], loop_histogram[6], loop_histogram[7],
+    ESP.getFreeHeap(), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT), ESP.getMinFreeHeap(),
+    uxTaskGetStackHighWaterMark(NULL),  // of the calling task, so call from loop()
+    task_stack[task_mqtt], task_stack[task_geoloc], task_stack[task_leds], task_stack[task_gesture], task_stack[task_temp],
+    draw_count ? draw_sum_ms / draw_count : 0, draw_max_ms, image_hits, image_misses, led_transmits, led_skips, led_jitter_us,
+    latency_max_ms, latency_histogram[0], latency_histogram[1], latency_histogram[2],
+    latency_histogram[3], latency_histogram[4], latency_histogram[5], gesture_reads, gesture_max_ms,
+    ntp_offset, ntp_syncs, (int)MqttConnection.state, MqttConnection.failures, boot_ms,
+    wifi_ms, wifi_fast ? 1 : 0, config_writes, geoloc_heap);
+  reset();
+  return len;
+}
@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*
+ * Runtime performance counters: loop time, heap, stack of every task, display updates, image cache, LED updates,
+ * NTP, boot and WiFi connect time, heap during the geolocation query, button to display latency,
+ * gesture sensor reads, config writes to flash.
+ * Collected all the time, published as one JSON message on MQTT topic "report/metrics".
+ * Interval values (loop and draw times, cache hits) are reset after every report.
+ */
+
+#include "GLOBAL_DEFINES.h"
+
+class Metrics {
+public:
+  Metrics() : ntp_offset(0), ntp_syncs(0), boot_ms(0), wifi_ms(0), wifi_fast(false), config_writes(0), geoloc_heap(0),
+    task_handles(), task_stack(), task_lock(portMUX_INITIALIZER_UNLOCKED) { reset(); }
+
+  // Tasks besides loop() whose stack high-water mark (free bytes) is reported.
+  enum Task { task_mqtt, task_geoloc, task_leds, task_gesture, task_temp, task_count };
+
+  // Loop time histogram upper bounds in ms; the last bucket takes everything above.
+  const static uint8_t loop_buckets = 8;
+  const static uint16_t loop_bucket_ms[loop_buckets - 1];
+  // Same for the input latency: button edge to the display update being sent.
+  const static uint8_t latency_buckets = 6;
+  const static uint16_t latency_bucket_ms[latency_buckets - 1];
+
+  void recordLoopTime(uint32_t ms);
+  void recordDrawTime(uint32_t ms, bool image_was_cached);
+  void recordNtpOffset(int32_t seconds)       { ntp_offset = seconds; ntp_syncs++; }
+  void recordBootTime(uint32_t ms)            { boot_ms = ms; }
+  void recordWifiConnect(uint32_t ms, bool fast) { wifi_ms = ms; wifi_fast = fast; }
+  void recordLedShow(bool transmitted)        { if (transmitted) led_transmits++; else led_skips++; }
+  void recordLedFrame(uint32_t interval_us);
+  void recordInputLatency(uint32_t ms);
+  void recordConfigWrite()                    { config_writes++; }
+  void recordGeolocHeap(uint32_t free_bytes)  { geoloc_heap = free_bytes; }
+  void recordGestureRead(uint32_t ms)         { gesture_reads++; if (ms > gesture_max_ms) gesture_max_ms = ms; }
+  void registerTask(Task task, TaskHandle_t handle);
+  // A task that deletes itself calls this just before vTaskDelete(NULL); its last value stays in the report.
+  void recordTaskExit(Task task);
+
+  // Writes the JSON report into buf, then starts a new interval.
+  int report(char *buf, size_t size);
+
+private:
+  // interval
+  uint32_t loop_count, loop_sum_ms, loop_max_ms;
+  uint32_t loop_histogram[loop_buckets];
+  uint32_t draw_count, draw_sum_ms, draw_max_ms;
+  uint32_t image_hits, image_misses;
+  uint32_t led_transmits, led_skips;
+  uint32_t led_jitter_us;  // largest deviation of a backlight frame interval from BACKLIGHTS_FRAME_MS
+  uint32_t latency_max_ms;
+  uint32_t latency_histogram[latency_buckets];
+  uint32_t gesture_reads, gesture_max_ms;  // I2C time of readGesture(), in the gesture task
+  // since boot
+  int32_t  ntp_offset;
+  uint32_t ntp_syncs;
+  uint32_t boot_ms;  // reset to first clock frame
+  uint32_t wifi_ms;  // last connection: start of the attempt to got IP
+  bool     wifi_fast;
+  uint32_t config_writes;  // NVS writes, for flash wear
+  uint32_t geoloc_heap;    // lowest free heap seen during the last geolocation query (TLS + parsed reply)
+  TaskHandle_t task_handles[task_count];  // NULL when not running
+  uint32_t task_stack[task_count];        // 0 until the task ran
+  portMUX_TYPE task_lock;                 // a handle is only used while its task can't delete itself
+
+  void reset();
+};
+
+extern Metrics metrics;
+
+#endif // METRICS_H
@@ -0,0 +1,30 @@
+#include "MqttPayload.h"
+#include <string.h>
+
+bool MqttParseInt(const uint8_t* payload, unsigned int length, int* value) {
+  unsigned int i = 0;
+  bool negative = false;
+  int result = 0;
+  if ((i < length) && (payload[i] == '-' || payload[i] == '+')) {
+    negative = (payload[i] == '-');
+    i++;
+  }
+  unsigned int first_digit = i;
+  while ((i < length) && (payload[i] >= '0') && (payload[i] <= '9')) {
+    if (i - first_digit >= 9) return false;  // would overflow
+    result = result * 10 + (payload[i] - '0');
+    i++;
+  }
+  if (i == first_digit) return false;  // no digits
+  if ((i < length) && (payload[i] == '.')) {
+    i++;
+    while ((i < length) && (payload[i] >= '0') && (payload[i] <= '9')) i++;
+  }
+  if (i != length) return false;  // trailing garbage
+  *value = negative ? -result : result;
+  return true;
+}
+
+bool MqttPayloadIs(const uint8_t* payload, unsigned int length, const char* text) {
+  return (length == strlen(text)) && (memcmp(payload, text, length) == 0);
+}
@@ -0,0 +1,17 @@
+#ifndef MQTT_PAYLOAD_H_
+#define MQTT_PAYLOAD_H_
+
+/*
+ * Parsing of MQTT command payloads. Payloads are not 0 terminated, so everything takes a length.
+ * No Arduino dependencies, so it is unit tested on the host (test/test_mqtt_payload).
+ */
+
+#include <stdint.h>
+
+// Integer without copying or floating point. Accepts an optional sign, up to 9 digits and an optional
+// fraction, which is truncated (like the "(int)atof()" it replaces). *value is untouched on failure.
+bool MqttParseInt(const uint8_t* payload, unsigned int length, int* value);
+// Exact match.
+bool MqttPayloadIs(const uint8_t* payload, unsigned int length, const char* text);
+
+#endif /* MQTT_PAYLOAD_H_ */
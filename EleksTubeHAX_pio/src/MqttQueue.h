@@ -0,0 +1,102 @@
+#ifndef MQTT_QUEUE_H_
+#define MQTT_QUEUE_H_
+
+/*
+ * Outgoing MQTT messages, waiting to be published one at a time at a limited rate, so the caller never
+ * waits for the broker. A newer message for a topic that is still waiting replaces the older one,
+ * keeping its place in the queue. When the queue is full the oldest message is dropped.
+ *
+ * One message is much longer than everything else (the metrics report). It gets a slot of its own,
+ * written in place, instead of sizing every queue slot for it. It is sent when the queue is empty.
+ *
+ * Sizes are template arguments, see GLOBAL_DEFINES.h. No Arduino dependencies, so it is unit tested
+ * on the host (test/test_mqtt_queue).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+template <uint8_t length, uint16_t topic_size, uint16_t message_size, uint16_t large_size>
+class MqttQueue {
+public:
+  typedef void (*PublishFunction)(const char *topic, const char *message);
+  enum PushResult { queued, replaced, dropped_oldest };
+
+  MqttQueue() : head(0), count(0), large_pending(false), last_publish_ms(0) {
+    dropped[0] = '\0';
+    large_topic[0] = '\0';
+    large[0] = '\0';
+  }
+
+  // *truncated: the message did not fit its slot. After dropped_oldest, droppedTopic() says which one.
+  PushResult push(const char *topic, const char *message, bool *truncated) {
+    PushResult result = queued;
+    uint8_t i, idx = 0;
+    for (i = 0; i < count; i++) {
+      idx = (head + i) % length;
+      if (strcmp(slots[idx].topic, topic) == 0) {
+        result = replaced;
+        break;
+      }
+    }
+    if (result != replaced) {
+      if (count == length) {
+        snprintf(dropped, sizeof(dropped), "%s", slots[head].topic);
+        head = (head + 1) % length;
+        count--;
+        result = dropped_oldest;
+      }
+      idx = (head + count) % length;
+      snprintf(slots[idx].topic, topic_size, "%s", topic);
+      count++;
+    }
+    *truncated = (snprintf(slots[idx].message, message_size, "%s", message) >= message_size);
+    return result;
+  }
+  const char *droppedTopic()  { return dropped; }
+
+  // Write the long message into largeMessage() (largeSize() bytes), then pushLarge(). A long message
+  // that is still waiting is replaced.
+  char *largeMessage()        { return large; }
+  size_t largeSize()          { return large_size; }
+  void pushLarge(const char *topic) {
+    snprintf(large_topic, sizeof(large_topic), "%s", topic);
+    large_pending = true;
+  }
+
+  // Publishes at most one message, none within interval_ms of the last one. True if one was published.
+  bool publishNext(uint32_t now_ms, uint32_t interval_ms, PublishFunction publish) {
+    if (isEmpty() || (now_ms - last_publish_ms < interval_ms)) return false;
+    if (count > 0) {
+      publish(slots[head].topic, slots[head].message);
+      head = (head + 1) % length;
+      count--;
+    } else {
+      publish(large_topic, large);
+      large_pending = false;
+    }
+    last_publish_ms = now_ms;
+    return true;
+  }
+
+  bool isEmpty()              { return (count == 0) && !large_pending; }
+  uint8_t waiting()           { return count; }  // in the queue, not counting the long message
+
+private:
+  struct Message {
+    char topic[topic_size];
+    char message[message_size];
+  };
+  Message slots[length];
+  uint8_t head;   // oldest message, sent next
+  uint8_t count;
+  char dropped[topic_size];
+  char large_topic[topic_size];
+  char large[large_size];
+  bool large_pending;
+  uint32_t last_publish_ms;
+};
+
+#endif /* MQTT_QUEUE_H_ */
@@ -0,0 +1,36 @@
+#include "MqttReconnect.h"
+
+uint32_t MqttReconnectBackoff(uint32_t failures, uint32_t random, uint32_t min_ms, uint32_t max_ms) {
+  uint32_t backoff = min_ms;
+  for (uint32_t i = 1; (i < failures) && (backoff < max_ms); i++) {
+    backoff *= 2;
+  }
+  if (backoff > max_ms) backoff = max_ms;
+  return backoff + random % (backoff / 4 + 1);
+}
+
+bool MqttReconnect::startAttempt(uint32_t now_ms) {
+  if (state != mqtt_disconnected) return false;
+  if ((attempts > 0) && (now_ms - last_attempt_ms < backoff_ms)) return false;
+  state = mqtt_connecting;
+  attempts++;
+  return true;
+}
+
+void MqttReconnect::succeeded(uint32_t now_ms) {
+  failures = 0;
+  backoff_ms = min_ms;
+  last_attempt_ms = now_ms;
+  state = mqtt_connected;
+}
+
+void MqttReconnect::failed(uint32_t now_ms, uint32_t random) {
+  failures++;
+  backoff_ms = MqttReconnectBackoff(failures, random, min_ms, max_ms);
+  last_attempt_ms = now_ms;
+  state = mqtt_disconnected;
+}
+
+void MqttReconnect::lost() {
+  if (state == mqtt_connected) state = mqtt_disconnected;
+}
@@ -0,0 +1,43 @@
+#ifndef MQTT_RECONNECT_H_
+#define MQTT_RECONNECT_H_
+
+/*
+ * When to (re)connect to the MQTT broker: the connection state, and exponential backoff with random
+ * jitter after failed attempts, so a fleet of clocks doesn't reconnect in lockstep after an outage.
+ * The clock and the random number are passed in, so it is unit tested on the host (test/test_mqtt_reconnect).
+ */
+
+#include <stdint.h>
+
+enum MqttConnectionState_t { mqtt_disconnected, mqtt_connecting, mqtt_connected };
+
+// Wait after `failures` failed attempts in a row (at least 1): min_ms, doubled for every further failure,
+// at most max_ms, plus up to 25% of that from random.
+uint32_t MqttReconnectBackoff(uint32_t failures, uint32_t random, uint32_t min_ms, uint32_t max_ms);
+
+class MqttReconnect {
+public:
+  MqttReconnect(uint32_t min_ms, uint32_t max_ms) :
+    state(mqtt_disconnected), attempts(0), failures(0), backoff_ms(min_ms),
+    min_ms(min_ms), max_ms(max_ms), last_attempt_ms(0) {}
+
+  // Disconnected and the backoff since the last attempt has passed (the very first attempt is due at
+  // once): goes to connecting and returns true. The caller connects, then calls succeeded() or failed().
+  bool startAttempt(uint32_t now_ms);
+  void succeeded(uint32_t now_ms);
+  void failed(uint32_t now_ms, uint32_t random);
+  // The connection dropped.
+  void lost();
+  bool isConnected()  { return state == mqtt_connected; }
+
+  volatile MqttConnectionState_t state;
+  uint32_t attempts;
+  uint32_t failures;    // since the last successful connection
+  uint32_t backoff_ms;  // before the next attempt
+
+private:
+  uint32_t min_ms, max_ms;
+  uint32_t last_attempt_ms;
+};
+
+#endif /* MQTT_RECONNECT_H_ */
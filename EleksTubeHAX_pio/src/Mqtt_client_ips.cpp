@@ -14,12 +14,16 @@
 #include "WiFi.h"       // for ESP32
 #include <PubSubClient.h>  // Download and install this library first from: https://www.arduinolibraries.info/libraries/pub-sub-client
 #include "TempSensor.h"
+#include <TimeLib.h>
+#include "WiFi_WPS.h"
+#include "Metrics.h"
+#include "MqttPayload.h"
+#include "MqttQueue.h"
 
 WiFiClient espClient;
 PubSubClient MQTTclient(espClient);
 
 // private:
-int splitTopic(char* topic, char* tokens[], int tokensNumber);
 void callback(char* topic, byte* payload, unsigned int length);
 
 void MqttProcessCommand();
@@ -28,23 +32,35 @@ void MqttReportStatus();
 void MqttReportPowerState();
 void MqttReportWiFiSignal();
 void MqttReportTemperature();
+void MqttReportTemperatureHistory();
 void MqttReportNotification(String message);
 void MqttReportBackOnChange();
 void MqttReportBackEverything();
 void MqttPeriodicReportBack();
+void MqttPeriodicReportMetrics();
+void MqttPublishQueued();
+#ifdef MQTT_REPORT_JSON
+void MqttReportState();
+#endif
 
 char topic[100];
 char msg[5];
 uint32_t lastTimeSent = (uint32_t)(MQTT_REPORT_STATUS_EVERY_SEC * -1000);
+uint32_t lastTimeMetricsSent = 0;
 uint8_t LastNotificationChecksum = 0;
-uint32_t LastTimeTriedToConnect = 0;
 
 bool MqttConnected = true; // skip error meggase if disabled
+MqttReconnect MqttConnection(MQTT_RECONNECT_MIN_SEC * 1000, MQTT_RECONNECT_MAX_SEC * 1000);
+volatile bool MqttJustConnected = false;
+TaskHandle_t MqttConnectTaskHandle = NULL;
 // commands from server    // = "directive/status"
 bool MqttCommandPower = true;
 int  MqttCommandState = 1;  
 bool MqttCommandPowerReceived = false;
 bool MqttCommandStateReceived = false;
+uint8_t  MqttCommandProgram[Backlights::program_max_size];
+uint16_t MqttCommandProgramLength = 0;
+bool MqttCommandProgramReceived = false;
 
 // status to server
 bool MqttStatusPower = true;
@@ -56,39 +72,64 @@ int LastSentPowerState = -1;
 int LastSentStatus = -1;
 
 
+// Outgoing messages are queued and sent from MqttLoopFrequently(), one every MQTT_PUBLISH_INTERVAL_MS,
+// so loop() never waits for the broker. The metrics report goes into the queue's long message slot.
+MqttQueue<MQTT_QUEUE_LENGTH, MQTT_QUEUE_TOPIC_SIZE, MQTT_QUEUE_MESSAGE_SIZE, MQTT_METRICS_MESSAGE_SIZE> MqttOutQueue;
+
+void MqttPublish(const char* topic, const char* message);
+
 void sendToBroker(const char* topic, const char* message) {
-  if (MQTTclient.connected()) {
-    char topicArr[100];
-    sprintf(topicArr, "%s/%s", MQTT_CLIENT, topic);
-    MQTTclient.publish(topicArr, message);
+  if (MqttConnection.isConnected()) {
+    bool truncated;
+    if (MqttOutQueue.push(topic, message, &truncated) == MqttOutQueue.dropped_oldest) {
+      Serial.print("MQTT queue full, dropping: ");
+      Serial.println(MqttOutQueue.droppedTopic());
+    }
+    if (truncated) {
+      Serial.print("MQTT message truncated: ");
+      Serial.println(topic);
+    }
+  }
+}
+
+// Sends at most one queued message per call, rate limited.
+void MqttPublishQueued() {
+  if (!MqttConnection.isConnected()) return;
+  MqttOutQueue.publishNext(millis(), MQTT_PUBLISH_INTERVAL_MS, MqttPublish);
+}
+
+void MqttPublish(const char* topic, const char* message) {
+  char topicArr[100];
+  snprintf(topicArr, sizeof(topicArr), "%s/%s", MQTT_CLIENT, topic);
+  MQTTclient.publish(topicArr, message);
 #ifdef DEBUG_OUTPUT // long output
-    Serial.print("Sending to MQTT: ");
-    Serial.print(topicArr);
-    Serial.print("/");
-    Serial.println(message);
+  Serial.print("Sending to MQTT: ");
+  Serial.print(topicArr);
+  Serial.print("/");
+  Serial.println(message);
 #else
-    Serial.print("TX MQTT: ");
-    Serial.print(topic);
-    Serial.print("/");
-    Serial.println(message);
+  Serial.print("TX MQTT: ");
+  Serial.print(topic);
+  Serial.print("/");
+  Serial.println(message);
 #endif    
-    delay (120);  
-  }
 }
 
-void MqttStart() {
-#ifdef MQTT_ENABLED
-  MqttConnected = false;
-  if (((millis() - LastTimeTriedToConnect) > (MQTT_RECONNECT_WAIT_SEC * 1000)) || (LastTimeTriedToConnect == 0)) {
-    LastTimeTriedToConnect = millis();
-    MQTTclient.setServer(MQTT_BROKER, MQTT_PORT);
-    MQTTclient.setCallback(callback);
-
-    Serial.println("Connecting to MQTT...");
-    if (MQTTclient.connect(MQTT_CLIENT, MQTT_USERNAME, MQTT_PASSWORD)) {
+// Connecting (TCP connect + MQTT CONNECT round trip) blocks, so it is done in its own task, never in loop().
+// The task only touches MQTTclient while not connected, loop() only while connected.
+void MqttConnectTask(void *parameter) {
+  for (;;) {
+    if ((WifiState == connected) && MqttConnection.startAttempt(millis())) {
+      Serial.println("Connecting to MQTT...");
+      if (MQTTclient.connect(MQTT_CLIENT, MQTT_USERNAME, MQTT_PASSWORD)) {
         Serial.println("MQTT connected");
-        MqttConnected = true;
-    } else {
+        char subscibeTopic[100];
+        sprintf(subscibeTopic, "%s/#", MQTT_CLIENT);
+        MQTTclient.subscribe(subscibeTopic);  //Subscribes to all messages send to the device
+
+        MqttJustConnected = true;  // before the state, loop() acts on both
+        MqttConnection.succeeded(millis());
+      } else {
         if (MQTTclient.state() == 5) {
             Serial.println("Connection not allowed by broker, possible reasons:");
             Serial.println("- Device is already online. Wait some seconds until it appears offline");
@@ -98,96 +139,145 @@ void MqttStart() {
             Serial.print("Not possible to connect to Broker Error code:");
             Serial.println(MQTTclient.state());
         }
-        return;  // do not continue if not connected
+        MqttConnection.failed(millis(), esp_random());
       }
-      
-    char subscibeTopic[100];
-    sprintf(subscibeTopic, "%s/#", MQTT_CLIENT);
-    MQTTclient.subscribe(subscibeTopic);  //Subscribes to all messages send to the device
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+}
 
+void MqttStart() {
+#ifdef MQTT_ENABLED
+  MqttConnected = false;
+  MQTTclient.setServer(MQTT_BROKER, MQTT_PORT);
+  MQTTclient.setCallback(callback);
+  MQTTclient.setBufferSize(MQTT_BUFFER_SIZE);
+  if (MqttConnectTaskHandle == NULL) {
+    if (xTaskCreate(MqttConnectTask, "mqtt_connect", 4096, NULL, 1, &MqttConnectTaskHandle) == pdPASS) {
+      metrics.registerTask(Metrics::task_mqtt, MqttConnectTaskHandle);
+    } else {
+      MqttConnectTaskHandle = NULL;
+    }
+  }
+#endif
+}
+
+// Called from loop() after the connect task has connected.
+void MqttReportOnline() {
     sendToBroker("report/online", "true");  // Reports that the device is online
     sendToBroker("report/firmware", FIRMWARE_VERSION);  // Reports the firmware version
     sendToBroker("report/ip", (char*)WiFi.localIP().toString().c_str());  // Reports the ip
     sendToBroker("report/network", (char*)WiFi.SSID().c_str());  // Reports the network name
+#ifdef MQTT_REPORT_JSON
+    MqttReportState();
+#else
     MqttReportWiFiSignal();
-  }
 #endif
 }
 
-int splitTopic(char* topic, char* tokens[], int tokensNumber) {
-    const char s[2] = "/";
-    int pos = 0;
-    tokens[0] = strtok(topic, s);
-    while (pos < tokensNumber - 1 && tokens[pos] != NULL) {
-        pos++;
-        tokens[pos] = strtok(NULL, s);
+void checkMqtt() {
+  if (MqttConnection.isConnected()) {
+    if (!MQTTclient.connected()) {
+      Serial.println("MQTT connection lost");
+      MqttConnection.lost();  // hand the client back to the connect task
+    } else if (MqttJustConnected) {
+      MqttJustConnected = false;
+      MqttReportOnline();
     }
-    return pos;
+  }
+  MqttConnected = (MqttConnection.isConnected());
 }
 
-void checkMqtt() {
-  MqttConnected = MQTTclient.connected();
-  if (!MqttConnected) {
-        MqttStart();
+void MqttCommandPowerState(const byte* payload, unsigned int length) {  // Turn On or OFF
+  if (MqttPayloadIs(payload, length, "ON")) {
+    MqttCommandPower = true;
+    MqttCommandPowerReceived = true;
+    MqttReportBackEverything();
+  } else if (MqttPayloadIs(payload, length, "OFF")) {
+    MqttCommandPower = false;
+    MqttCommandPowerReceived = true;
+    MqttReportBackEverything();
+  }
+}
+
+void MqttCommandSetpoint(const byte* payload, unsigned int length) {
+  int value;
+  if (MqttParseInt(payload, length, &value)) {
+    MqttCommandState = value;
+    MqttCommandStateReceived = true;
+    MqttReportBackEverything();
+  }
+}
+
+// Backlights keyframe program, as hex text (2 characters per byte). Checked by Backlights::loadProgram().
+void MqttCommandBacklightProgram(const byte* payload, unsigned int length) {
+  if (length % 2 != 0) return;
+  for (unsigned int i = 0; i < length; i += 2) {
+    uint8_t value = 0;
+    for (uint8_t j = 0; j < 2; j++) {
+      char c = payload[i + j];
+      if (c >= '0' && c <= '9')      value = (value << 4) | (c - '0');
+      else if (c >= 'a' && c <= 'f') value = (value << 4) | (c - 'a' + 10);
+      else if (c >= 'A' && c <= 'F') value = (value << 4) | (c - 'A' + 10);
+      else return;
     }
+    MqttCommandProgram[i / 2] = value;
+  }
+  MqttCommandProgramLength = length / 2;
+  MqttCommandProgramReceived = true;
 }
 
+// Topics we react to, below "MQTT_CLIENT/". Longer payloads are ignored without looking at them.
+struct MqttCommandEntry {
+  const char* topic;
+  void (*handler)(const byte* payload, unsigned int length);
+  unsigned int max_length;
+};
+
+const MqttCommandEntry MqttCommands[] = {
+  { "directive/powerState", MqttCommandPowerState, 3  },
+  { "directive/setpoint",   MqttCommandSetpoint,   16 },  // SmartNest
+  { "directive/percentage", MqttCommandSetpoint,   16 },  // SmartThings
+  { "directive/backlightProgram", MqttCommandBacklightProgram, 2 * Backlights::program_max_size },
+};
+
 void callback(char* topic, byte* payload, unsigned int length) {  //A new message has been received
-#ifdef DEBUG_OUTPUT
-    Serial.print("Received MQTT topic: ");
-    Serial.print(topic);                       // long output
-#endif    
-    int tokensNumber = 10;
-    char* tokens[tokensNumber];
-    char message[length + 1];
-    tokensNumber = splitTopic(topic, tokens, tokensNumber);
-    sprintf(message, "%c", (char)payload[0]);
-    for (int i = 1; i < length; i++) {
-        sprintf(message, "%s%c", message, (char)payload[i]);
+  // All subscribed topics start with "MQTT_CLIENT/"
+  const unsigned int prefix_length = sizeof(MQTT_CLIENT) - 1;
+  if ((strncmp(topic, MQTT_CLIENT, prefix_length) != 0) || (topic[prefix_length] != '/')) {
+    return;
+  }
+  const char* command = topic + prefix_length + 1;
+
+  for (uint8_t i = 0; i < sizeof(MqttCommands) / sizeof(MqttCommands[0]); i++) {
+    if (strcmp(command, MqttCommands[i].topic) == 0) {
+      if (length > MqttCommands[i].max_length) {
+        Serial.print("MQTT RX: payload too long for ");
+        Serial.println(command);
+        return;
+      }
+      Serial.print("MQTT RX: ");
+      Serial.print(command);
+      Serial.print("/");
+      Serial.write(payload, length);
+      Serial.println();
+      MqttCommands[i].handler(payload, length);
+      return;
     }
+  }
 #ifdef DEBUG_OUTPUT
-    Serial.print("\t     Message: ");
-    Serial.println(message);
-#else    
-    Serial.print("MQTT RX: ");
-    Serial.print(tokens[1]);
-    Serial.print("/");
-    Serial.print(tokens[2]);
-    Serial.print("/");
-    Serial.println(message);
+  Serial.print("Received MQTT topic: ");
+  Serial.println(topic);                       // long output; our own reports end up here too
 #endif    
-
-    if (tokensNumber < 3) {
-        // otherwise code below crashes on the strmp on non-initialized pointers in tokens[] array
-        Serial.println("Number of tokens in MQTT message < 3!");
-        return; 
-    }
-    
-    //------------------Decide what to do depending on the topic and message---------------------------------
-    if (strcmp(tokens[1], "directive") == 0 && strcmp(tokens[2], "powerState") == 0) {  // Turn On or OFF
-        if (strcmp(message, "ON") == 0) {
-            MqttCommandPower = true;
-            MqttCommandPowerReceived = true;
-            MqttReportBackEverything();
-        } else if (strcmp(message, "OFF") == 0) {
-            MqttCommandPower = false;
-            MqttCommandPowerReceived = true;
-            MqttReportBackEverything();
-        }                                                       //      SmartNest:                         // SmartThings
-    } else if (strcmp(tokens[1], "directive") == 0 && (strcmp(tokens[2], "setpoint") == 0) || (strcmp(tokens[2], "percentage") == 0)) {
-            double valueD = atof(message);
-            if (!isnan(valueD)) {
-              MqttCommandState = (int) valueD;
-              MqttCommandStateReceived = true;
-              MqttReportBackEverything();
-            }
-      }
- }
+}
 
 void MqttLoopFrequently(){
 #ifdef MQTT_ENABLED
-  MQTTclient.loop(); 
+  if (MqttConnection.isConnected()) {
+    MQTTclient.loop(); 
+  }
   checkMqtt();
+  MqttPublishQueued();
 #endif  
 }
 
@@ -195,6 +285,7 @@ void MqttLoopInFreeTime(){
 #ifdef MQTT_ENABLED
   MqttReportBackOnChange();
   MqttPeriodicReportBack();
+  MqttPeriodicReportMetrics();
 #endif  
 }
 
@@ -221,6 +312,14 @@ void MqttReportTemperature() {
   #endif  
 }    
 
+void MqttReportTemperatureHistory() {
+  #ifdef ONE_WIRE_BUS_PIN
+  char message[MQTT_QUEUE_MESSAGE_SIZE];
+  TemperatureHistory.report(message, sizeof(message), now());
+  sendToBroker("report/temperatureHistory", message);
+  #endif
+}
+
 void MqttReportPowerState() {
   if (MqttStatusPower != LastSentPowerState) {
     if (MqttStatusPower != 0) {
@@ -258,22 +357,68 @@ void MqttReportNotification(String message) {
   }
 }
 
+#ifdef MQTT_REPORT_JSON
+// Everything in one message: {"powerState":"ON","setpoint":10,"signal":-67,"temperature":23.45}
+char MqttStateJson[MQTT_QUEUE_MESSAGE_SIZE];
+
+void MqttReportState() {
+  int SignalLevel = WiFi.RSSI();
+  int len = snprintf(MqttStateJson, sizeof(MqttStateJson), "{\"powerState\":\"%s\",\"setpoint\":%d,\"signal\":%d",
+                     MqttStatusPower ? "ON" : "OFF", MqttStatusState, SignalLevel);
+  #ifdef ONE_WIRE_BUS_PIN
+  if (fTemperature > -30) { // transmit data to MQTT only if data is valid
+    len += snprintf(MqttStateJson + len, sizeof(MqttStateJson) - len, ",\"temperature\":%s", sTemperatureTxt);
+  }
+  #endif
+  snprintf(MqttStateJson + len, sizeof(MqttStateJson) - len, "}");
+  sendToBroker("report/state", MqttStateJson);
+
+  LastSentPowerState = MqttStatusPower;
+  LastSentStatus = MqttStatusState;
+  LastSentSignalLevel = SignalLevel;
+}
+#endif
+
 void MqttReportBackEverything() {
+#ifdef MQTT_REPORT_JSON
+    MqttReportState();
+#else
     MqttReportPowerState();
     MqttReportStatus();
 //    MqttReportBattery();
     MqttReportWiFiSignal();
     MqttReportTemperature();
+#endif
+    MqttReportTemperatureHistory();
     lastTimeSent = millis();
 }
 
 void MqttReportBackOnChange() {
+#ifdef MQTT_REPORT_JSON
+  if ((MqttStatusPower != LastSentPowerState) || (MqttStatusState != LastSentStatus)) {
+    MqttReportState();
+  }
+#else
     MqttReportPowerState();
     MqttReportStatus();
+#endif
 }
   
 void MqttPeriodicReportBack() {
-  if (((millis() - lastTimeSent) > (MQTT_REPORT_STATUS_EVERY_SEC * 1000)) && MQTTclient.connected()) {
+  if (((millis() - lastTimeSent) > (MQTT_REPORT_STATUS_EVERY_SEC * 1000)) && (MqttConnection.isConnected())) {
     MqttReportBackEverything();
     }
 }
+
+void MqttPeriodicReportMetrics() {
+#if MQTT_REPORT_METRICS_EVERY_SEC > 0
+  if (((millis() - lastTimeMetricsSent) > (MQTT_REPORT_METRICS_EVERY_SEC * 1000UL)) && (MqttConnection.isConnected())) {
+    // A report that is still waiting is replaced; report() starts a new interval either way.
+    if (metrics.report(MqttOutQueue.largeMessage(), MqttOutQueue.largeSize()) >= (int)MqttOutQueue.largeSize()) {
+      Serial.println("MQTT message truncated: report/metrics");
+    }
+    MqttOutQueue.pushLarge("report/metrics");
+    lastTimeMetricsSent = millis();
+  }
+#endif
+}
@@ -2,14 +2,22 @@
 #define mqtt_client_H_
 
 #include "GLOBAL_DEFINES.h"
+#include "Backlights.h"
+#include "MqttReconnect.h"
 
 extern bool MqttConnected;
 
+// connection, managed by a background task
+extern MqttReconnect MqttConnection;
+
 // commands from server
 extern bool MqttCommandPower;
 extern int  MqttCommandState;
 extern bool MqttCommandPowerReceived;
 extern bool MqttCommandStateReceived;
+extern uint8_t  MqttCommandProgram[Backlights::program_max_size];
+extern uint16_t MqttCommandProgramLength;
+extern bool MqttCommandProgramReceived;
 
 // status to server
 extern bool MqttStatusPower;
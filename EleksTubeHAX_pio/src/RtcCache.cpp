@@ -0,0 +1,27 @@
+#include "RtcCache.h"
+
+uint32_t RtcCache::get(uint32_t now_ms, uint32_t sqw_ticks) {
+  if (valid && (now_ms - cache_millis < reread_every_ms)) {
+    // The square wave keeps the cache exact; re-reading is only a sanity check against missed edges.
+    if (use_sqw) return cache_time + (sqw_ticks - cache_ticks);
+    return cache_time + (now_ms - cache_millis) / 1000;
+  }
+  return getFresh(now_ms, sqw_ticks);
+}
+
+uint32_t RtcCache::getFresh(uint32_t now_ms, uint32_t sqw_ticks) {
+  cache_time = read();
+  cache_millis = now_ms;
+  cache_ticks = sqw_ticks;
+  valid = true;
+  return cache_time;
+}
+
+void RtcCache::set(uint32_t t, uint32_t now_ms, uint32_t sqw_ticks) {
+  write(t);
+  cache_time = t;
+  cache_millis = now_ms;
+  // Writing the seconds register restarts the 1 Hz countdown.
+  cache_ticks = sqw_ticks;
+  valid = true;
+}
@@ -0,0 +1,42 @@
+#ifndef RTC_CACHE_H
+#define RTC_CACHE_H
+
+/*
+ * Cached RTC time. Reading the RTC is a bus transaction (I2C or bit-banged 3-wire), so the last
+ * reading is kept and extrapolated: with the 1 Hz square wave (if wired) by counting its edges,
+ * otherwise with millis(). The RTC itself is only read again when the cache gets old.
+ *
+ * The bus access is passed in as functions and the clocks as arguments, so it is unit tested on
+ * the host (test/test_rtc_cache).
+ */
+
+#include <stdint.h>
+
+class RtcCache {
+public:
+  typedef uint32_t (*ReadFunction)();
+  typedef void (*WriteFunction)(uint32_t t);
+
+  // use_sqw: the sqw_ticks arguments count the falling edges of the 1 Hz square wave.
+  // reread_every_sec: how long the extrapolated time is trusted.
+  RtcCache(ReadFunction read, WriteFunction write, bool use_sqw, uint32_t reread_every_sec) :
+    read(read), write(write), use_sqw(use_sqw), reread_every_ms(reread_every_sec * 1000),
+    cache_time(0), cache_millis(0), cache_ticks(0), valid(false) {}
+
+  void invalidate()                                     { valid = false; }
+  // Extrapolated; reads the RTC only when the cache is old.
+  uint32_t get(uint32_t now_ms, uint32_t sqw_ticks);
+  // Reads the RTC itself, not the extrapolation, and restarts the cache from it.
+  uint32_t getFresh(uint32_t now_ms, uint32_t sqw_ticks);
+  void set(uint32_t t, uint32_t now_ms, uint32_t sqw_ticks);
+
+private:
+  ReadFunction read;
+  WriteFunction write;
+  bool use_sqw;
+  uint32_t reread_every_ms;
+  uint32_t cache_time, cache_millis, cache_ticks;
+  bool valid;
+};
+
+#endif // RTC_CACHE_H
@@ -0,0 +1,95 @@
+#include "StoredConfig.h"
+
+void StoredConfig::load() {
+  uint8_t version = prefs.getUChar("version", 0);
+  if (version == 0) {
+    migrateFromBlob();
+  }
+  else {
+    if (version != schema_version) {
+      Serial.print("Config schema version ");
+      Serial.print(version);
+      Serial.println(" is unknown; loading the sections that still fit.");
+    }
+    loadSection("backlights", &config.backlights, sizeof(config.backlights));
+    loadSection("clock", &config.uclock, sizeof(config.uclock));
+    loadSection("wifi", &config.wifi, sizeof(config.wifi));
+  }
+  saved = config;
+  save_pending = false;
+  loadGeoloc();
+  loadWifiLink();
+  loaded = true;
+}
+
+// Zeroed (so is_valid is not valid) if the stored size doesn't match the struct.
+void StoredConfig::loadSection(const char *key, void *section, size_t size) {
+  if (prefs.getBytesLength(key) != size || prefs.getBytes(key, section, size) != size) {
+    Serial.print("Config section ");
+    Serial.print(key);
+    Serial.println(" missing or of a different size, using defaults.");
+    memset(section, 0, size);
+  }
+}
+
+void StoredConfig::migrateFromBlob() {
+  memset(&config, 0, sizeof(config));
+  size_t blob_size = prefs.getBytesLength(SAVED_CONFIG_NAMESPACE);
+  if (blob_size == sizeof(config)) {
+    prefs.getBytes(SAVED_CONFIG_NAMESPACE, &config, sizeof(config));
+    Serial.println("Migrating config to per-section keys.");
+  }
+  else if (blob_size != 0) {
+    Serial.println("Old config blob has a different layout, using defaults.");
+  }
+  // Write every section once, then drop the blob.
+  memset(&saved, 0xFF, sizeof(saved));
+  save();
+  if (blob_size != 0) {
+    prefs.remove(SAVED_CONFIG_NAMESPACE);
+  }
+  prefs.putUChar("version", schema_version);
+}
+
+void StoredConfig::saveLater() {
+  uint32_t now = millis();
+  if (!save_pending) {
+    millis_first_request = now;
+  }
+  save_pending = true;
+  millis_save_requested = now;
+}
+
+void StoredConfig::loop() {
+  if (!save_pending) return;
+  uint32_t now = millis();
+  if ((now - millis_save_requested >= CONFIG_SAVE_DELAY_SEC * 1000UL) ||
+      (now - millis_first_request >= CONFIG_SAVE_MAX_DELAY_SEC * 1000UL)) {
+    save();
+  }
+}
+
+void StoredConfig::save() {
+  save_pending = false;
+  uint8_t written = 0;
+  written += saveSection("backlights", &config.backlights, &saved.backlights, sizeof(config.backlights));
+  written += saveSection("clock", &config.uclock, &saved.uclock, sizeof(config.uclock));
+  written += saveSection("wifi", &config.wifi, &saved.wifi, sizeof(config.wifi));
+  if (written > 0) {
+    Serial.print("Config saved, sections written: ");
+    Serial.println(written);
+  }
+}
+
+bool StoredConfig::saveSection(const char *key, void *section, void *saved_section, size_t size) {
+  if (memcmp(section, saved_section, size) == 0) return false;
+  if (write(key, section, size) != size) return false;  // stays different, retried on the next save()
+  memcpy(saved_section, section, size);
+  return true;
+}
+
+// Every write to flash goes through here, so they can be counted.
+size_t StoredConfig::write(const char *key, const void *data, size_t size) {
+  metrics.recordConfigWrite();
+  return prefs.putBytes(key, data, size);
+}
@@ -2,6 +2,8 @@
 #define STORED_CONFIG_H
 
 #include "GLOBAL_DEFINES.h"
+#include "TimeSeries.h"
+#include "Metrics.h"
 
 #include <Preferences.h>
 /*
@@ -16,14 +18,38 @@
  * the way it is. -- @SmittyHalibut
  */
 
+/*
+ * Schema versions:
+ *   1: the whole Config as one blob, under the key SAVED_CONFIG_NAMESPACE. Migrated on load.
+ *   2: every section of Config under its own key, next to a "version" key.
+ * A section whose stored size doesn't match (the struct changed) is loaded as invalid, so its owner
+ * falls back to defaults instead of reading shifted fields. Bump schema_version when that needs a migration.
+ *
+ * save() only writes the sections that differ from what is in flash. saveLater() coalesces bursts of
+ * changes: loop() saves once nothing asked for a save for CONFIG_SAVE_DELAY_SEC, and at the latest
+ * CONFIG_SAVE_MAX_DELAY_SEC after the first request, so a steady stream of changes still gets saved.
+ */
 class StoredConfig {
 public:
-  StoredConfig() : prefs(), config_size(sizeof(config)), loaded(false) {}
-  void begin()    { prefs.begin(SAVED_CONFIG_NAMESPACE, false); Serial.print("Config size: "); Serial.println(config_size); }
-  void load()     { prefs.getBytes(SAVED_CONFIG_NAMESPACE, &config, config_size); loaded = true; }
-  void save()     { prefs.putBytes(SAVED_CONFIG_NAMESPACE, &config, config_size); }
-  bool isLoaded() { return loaded; }
+  StoredConfig() : prefs(), loaded(false), save_pending(false), millis_save_requested(0), millis_first_request(0) {}
+  void begin()    { prefs.begin(SAVED_CONFIG_NAMESPACE, false); Serial.print("Config size: "); Serial.println(sizeof(config)); }
+  void load();
+  void save();
+  void saveLater();
+  void loop();
+  bool isLoaded()   { return loaded; }
 
+  // Last geolocation result, kept under its own key so it can be refreshed without rewriting the main config.
+  void loadGeoloc() { if (prefs.getBytes("geoloc", &geoloc, sizeof(geoloc)) != sizeof(geoloc)) geoloc.is_valid = 0; }
+  void saveGeoloc() { write("geoloc", &geoloc, sizeof(geoloc)); }
+  // Last good WiFi connection, same reason.
+  void loadWifiLink() { if (prefs.getBytes("wifilink", &wifi_link, sizeof(wifi_link)) != sizeof(wifi_link)) wifi_link.is_valid = 0; }
+  void saveWifiLink() { write("wifilink", &wifi_link, sizeof(wifi_link)); }
+  // Sensor history, about 1.3 kB per key.
+  bool loadTimeSeries(const char *key, TimeSeries &series) { return prefs.getBytes(key, series.data(), series.dataSize()) == series.dataSize(); }
+  void saveTimeSeries(const char *key, TimeSeries &series) { write(key, series.data(), series.dataSize()); }
+
+  const static uint8_t schema_version = 2;
   const static uint8_t str_buffer_size = 32;
 
   struct Config {
@@ -51,13 +77,39 @@ public:
     } wifi;
   } config;
 
+  struct Geolocation {
+    char     tz[str_buffer_size];  // time zone name, like "Europe/Ljubljana"
+    double   offset;               // UTC offset in hours, DST included
+    bool     is_dst;
+    time_t   timestamp;            // UTC time of the query
+    uint8_t  is_valid;             // Write StoredConfig::valid here when valid data is loaded.
+  } geoloc;
+
+  // Lets a reconnect skip the scan (and optionally DHCP). No padding, so it can be compared with memcmp().
+  struct WifiLink {
+    uint32_t ip, gateway, subnet, dns;  // DHCP lease
+    uint8_t  bssid[6];
+    uint8_t  channel;
+    uint8_t  is_valid;             // Write StoredConfig::valid here when valid data is loaded.
+  } wifi_link;
+
   const static uint8_t valid = 0x55;  // neither 0x00 nor 0xFF, signaling loaded config isn't just default data.
   
 private:
   Preferences prefs;
-  uint16_t config_size; 
   bool loaded;
+  bool save_pending;
+  uint32_t millis_save_requested;
+  uint32_t millis_first_request;
+  Config saved;  // what is in flash, to find the changed sections
+
+  void loadSection(const char *key, void *section, size_t size);
+  bool saveSection(const char *key, void *section, void *saved_section, size_t size);
+  void migrateFromBlob();
+  size_t write(const char *key, const void *data, size_t size);
 };
 
 
+extern StoredConfig stored_config;
+
 #endif // STORED_CONFIG_H
@@ -2,6 +2,7 @@
 #include "WiFi_WPS.h"
 #include "Mqtt_client_ips.h"
 #include "TempSensor.h"
+#include "Metrics.h"
 
 void TFTs::begin() {
   // Start with all displays selected.
@@ -50,7 +51,7 @@ void TFTs::showNoWifiStatus() {
   setTextColor(TFT_RED, TFT_BLACK);
   fillRect(0, TFT_HEIGHT - 27, TFT_WIDTH, 27, TFT_BLACK);
   setCursor(5, TFT_HEIGHT - 27, 4);  // Font 4. 26 pixel high
-  print("NO WIFI !");
+  print(WifiState == wps_active ? "PRESS WPS" : "NO WIFI !");
   }
 
 void TFTs::showNoMqttStatus() {
@@ -70,7 +71,11 @@ void TFTs::showTemperature() {
       setCursor(5, TFT_HEIGHT - 17, 2);  // Font 2. 16 pixel high
       print("T: ");
       print(sTemperatureTxt);
+#ifdef TEMPERATURE_FAHRENHEIT
+      print(" F");
+#else
       print(" C");
+#endif
    }
 #ifdef DEBUG_OUTPUT
     Serial.println("Temperature to LCD");
@@ -442,7 +447,8 @@ void TFTs::DrawImage(uint8_t file_index) {
   Serial.println(file_index);  
 #endif  
   // check if file is already loaded into buffer; skip loading if it is. Saves 50 to 150 msec of time.
-  if (file_index != FileInBuffer) {
+  bool WasInBuffer = (file_index == FileInBuffer);
+  if (!WasInBuffer) {
 #ifdef DEBUG_OUTPUT
   Serial.println("Not preloaded; loading now...");  
 #endif  
@@ -453,6 +459,7 @@ void TFTs::DrawImage(uint8_t file_index) {
   setSwapBytes(true);
   pushImage(0,0, TFT_WIDTH, TFT_HEIGHT, (uint16_t *)UnpackedImageBuffer);
   setSwapBytes(oldSwapBytes);
+  metrics.recordDrawTime(millis() - StartTime, WasInBuffer);
 
 #ifdef DEBUG_OUTPUT
   Serial.print("img transfer time: ");  
@@ -1,10 +1,14 @@
 #ifndef TEMPSENSOR_H_
 #define TEMPSENSOR_H_
 
+#include "TimeSeries.h"
+
 extern float fTemperature;
 extern char sTemperatureTxt[10];
 extern bool bTemperatureUpdated;
+extern TimeSeries TemperatureHistory;  // 1/100 C
 
+void StartTemperatureSensor(void);
 void PeriodicReadTemperature(void);
 
 #endif  // TEMPSENSOR_H_
@@ -3,11 +3,15 @@
 
 
 //#include "GLOBAL_DEFINES.h"
+#include "TimeSeries.h"
+#include "Metrics.h"
+#include "TemperatureFormat.h"
+#include <TimeLib.h>
 
 float fTemperature = -127;
 char sTemperatureTxt[10];
 bool bTemperatureUpdated = false;
-uint32_t lastTimeRead = (uint32_t)(TEMPERATURE_READ_EVERY_SEC * -1000);
+TimeSeries TemperatureHistory(100);  // 1/100 C
 
 #ifdef ONE_WIRE_BUS_PIN
 // For some reason the following two library includes fail on compilation if placed in a .c file outside of the main .ino file.
@@ -24,49 +28,89 @@ OneWire oneWire(ONE_WIRE_BUS_PIN);
 // Pass our oneWire reference to Dallas Temperature sensor
 DallasTemperature sensors(&oneWire);
 
-void GetTemperatureDS18B20() {
-  Serial.print("Reading temperature... ");
-  sensors.requestTemperatures();  // all sensors on the bus
-  fTemperature = sensors.getTempCByIndex(0); // only one sensor (search ROM and read temp)
-
-  // sprintf(sTemperatureTxt, "%d", (int)fTemperature);  
-
-
-// char* tempToAscii(float temp) // convert long to type char and store in variable array ascii
-// https://forum.arduino.cc/t/printing-a-double-variable/44327/17
-// http://www.nongnu.org/avr-libc/user-manual/group__avr__stdlib.html#gaa571de9e773dde59b0550a5ca4bd2f00
-    int frac;
-    int rnd;
-
-    rnd  = (int)(fTemperature*1000)%10;
-    frac = (int)(fTemperature*100)%100;  //get three numbers to the right of the deciaml point.
-    if (rnd>=5) frac=frac+1;
-    itoa((int)fTemperature, sTemperatureTxt, 10);
-    strcat(sTemperatureTxt,".");
+// Written by the sensor task, picked up by PeriodicReadTemperature() in loop().
+volatile int32_t TemperatureRaw = DEVICE_DISCONNECTED_RAW;  // 1/128 C
+volatile bool TemperatureRawReady = false;
+
+// The OneWire bus is only used from this task. A conversion takes up to 750 ms (12 bit); the task
+// sleeps through it instead of blocking loop().
+void TemperatureTask(void *parameter) {
+  DeviceAddress address;
+  bool have_address = false;
+  while (true) {
+    if (!have_address) {
+      have_address = sensors.getAddress(address, 0);  // only one sensor (search ROM)
+    }
+    if (have_address) {
+      sensors.requestTemperatures();  // starts the conversion and returns
+      vTaskDelay(pdMS_TO_TICKS(sensors.millisToWaitForConversion(sensors.getResolution())));
+      int32_t raw = sensors.getTemp(address);
+      if (raw == DEVICE_DISCONNECTED_RAW) {
+        have_address = false;  // search again next time
+      }
+      TemperatureRaw = raw;
+      TemperatureRawReady = true;
+    }
+    vTaskDelay(pdMS_TO_TICKS(TEMPERATURE_READ_EVERY_SEC * 1000));
+  }
+}
 
-    if (frac < 10) {itoa(0,&sTemperatureTxt[strlen(sTemperatureTxt)], 10); }   // if fract < 10 should print .0 fract ie if fract=6 print .06
+static_assert(TEMPERATURE_DISCONNECTED_RAW == DEVICE_DISCONNECTED_RAW, "TemperatureFormat.h must know the sentinel");
 
-    itoa(frac, &sTemperatureTxt[strlen(sTemperatureTxt)], 10); //put the frac after the deciaml
-    
-//    sprintf(sTemperatureTxt, "%d.%d", intPart, fracPart);
+#ifdef TEMPERATURE_FAHRENHEIT
+const bool TemperatureFahrenheit = true;
+#else
+const bool TemperatureFahrenheit = false;
+#endif
+#endif // sensor defined
 
 
-  bTemperatureUpdated = true;
- 
-  //Serial.print(fTemperature); // print float directly, for testing purposes only
-  //Serial.print("  /  ");
-  Serial.print(sTemperatureTxt);
-  Serial.println(" C");  
+void StartTemperatureSensor() {
+  #ifdef ONE_WIRE_BUS_PIN
+  sensors.begin();
+  sensors.setWaitForConversion(false);
+#ifdef TEMPERATURE_HISTORY_PERSIST
+  if (!stored_config.loadTimeSeries("temphist", TemperatureHistory) || !TemperatureHistory.isValid()) {
+    TemperatureHistory.clear();
+  }
+#endif
+  // 2 kB was tight for OneWire and DallasTemperature. The free stack is reported as "stack_temp" in report/metrics.
+  TaskHandle_t task_handle;
+  if (xTaskCreate(TemperatureTask, "temperature", 3072, NULL, 1, &task_handle) != pdPASS) {
+    Serial.println("Temperature task failed to start.");
+    return;
+  }
+  metrics.registerTask(Metrics::task_temp, task_handle);
+  #endif
 }
-#endif // sensor defined
-
 
 void PeriodicReadTemperature() {
   #ifdef ONE_WIRE_BUS_PIN
-  if ((millis() - lastTimeRead) > (TEMPERATURE_READ_EVERY_SEC * 1000)) {
-    GetTemperatureDS18B20();
-    lastTimeRead = millis();
+  if (TemperatureRawReady) {
+    int32_t raw = TemperatureRaw;
+    TemperatureRawReady = false;
+    if (!FormatTemperature(sTemperatureTxt, sizeof(sTemperatureTxt), raw, TemperatureFahrenheit)) {
+      // Not a temperature: it would read "-55.00". The text is left empty.
+      fTemperature = DEVICE_DISCONNECTED_C;
+      bTemperatureUpdated = true;
+      Serial.println("Temperature sensor disconnected.");
+      return;
+    }
+    fTemperature = raw / 128.0f;
+    bool new_hour = TemperatureHistory.add(now(), TemperatureCenti(raw));
+#ifdef TEMPERATURE_HISTORY_PERSIST
+    if (new_hour) {
+      stored_config.saveTimeSeries("temphist", TemperatureHistory);  // once an hour, so at most an hour is lost
     }
+#else
+    (void)new_hour;
+#endif
+    bTemperatureUpdated = true;
+
+    Serial.print("Temperature: ");
+    Serial.print(sTemperatureTxt);
+    Serial.println(TemperatureFahrenheit ? " F" : " C");
+  }
   #endif
 }
 
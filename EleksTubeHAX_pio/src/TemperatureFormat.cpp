@@ -0,0 +1,22 @@
+#include "TemperatureFormat.h"
+#include <stdio.h>
+
+int32_t TemperatureCenti(int32_t raw) {
+  return (raw * 100 + (raw < 0 ? -64 : 64)) / 128;
+}
+
+// F = C * 9 / 5 + 32: raw * 100 * 9 / (128 * 5) = raw * 45 / 32 hundredths above 32 F.
+int32_t TemperatureCentiF(int32_t raw) {
+  return (raw * 45 + (raw < 0 ? -16 : 16)) / 32 + 3200;
+}
+
+bool FormatTemperature(char *buf, size_t size, int32_t raw, bool fahrenheit) {
+  if (raw == TEMPERATURE_DISCONNECTED_RAW) {
+    if (size > 0) buf[0] = '\0';
+    return false;
+  }
+  int32_t centi = fahrenheit ? TemperatureCentiF(raw) : TemperatureCenti(raw);
+  uint32_t abs_centi = centi < 0 ? -centi : centi;
+  snprintf(buf, size, "%s%u.%02u", centi < 0 ? "-" : "", (unsigned)(abs_centi / 100), (unsigned)(abs_centi % 100));
+  return true;
+}
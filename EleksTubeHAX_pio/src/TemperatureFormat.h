@@ -0,0 +1,21 @@
+#ifndef TEMPERATURE_FORMAT_H_
+#define TEMPERATURE_FORMAT_H_
+
+/*
+ * DS18B20 readings, in DallasTemperature's raw unit of 1/128 C, to fixed point and text. Integer only.
+ * No Arduino dependencies, so it is unit tested on the host (test/test_temperature_format).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+// DEVICE_DISCONNECTED_RAW: what getTemp() returns without a sensor. Would read as -55 C.
+#define TEMPERATURE_DISCONNECTED_RAW  (-7040)
+
+// Rounded.
+int32_t TemperatureCenti(int32_t raw);   // 1/100 C
+int32_t TemperatureCentiF(int32_t raw);  // 1/100 F
+// Two decimals, e.g. "21.50" or "-0.06". Empty, and false, for TEMPERATURE_DISCONNECTED_RAW.
+bool FormatTemperature(char *buf, size_t size, int32_t raw, bool fahrenheit);
+
+#endif /* TEMPERATURE_FORMAT_H_ */
@@ -0,0 +1,78 @@
+#include "TimeSeries.h"
+#include <stdio.h>
+#include <string.h>
+
+void TimeSeries::clear() {
+  memset(&buckets, 0, sizeof(buckets));
+  buckets.magic = magic;
+}
+
+void TimeSeries::addTo(Bucket &b, uint32_t index, int16_t value) {
+  if (b.index != index || b.count == 0) {
+    // Slot still holds an older minute/hour: start over.
+    b.index = index;
+    b.sum = 0;
+    b.min = value;
+    b.max = value;
+    b.count = 0;
+  }
+  b.sum += value;
+  if (value < b.min) b.min = value;
+  if (value > b.max) b.max = value;
+  b.count++;
+}
+
+bool TimeSeries::add(time_t t, int16_t value) {
+  uint32_t minute = (uint32_t)(t / 60);
+  uint32_t hour = minute / 60;
+  Bucket &h = buckets.hours[hour % hour_buckets];
+  bool new_hour = (h.index != hour || h.count == 0);
+  addTo(buckets.minutes[minute % minute_buckets], minute, value);
+  addTo(h, hour, value);
+  return new_hour;
+}
+
+// Buckets with newest - count < index <= newest.
+void TimeSeries::collect(const Bucket *b, uint8_t n, uint32_t newest, uint32_t count, Stats *stats, int32_t *sum) {
+  for (uint8_t i = 0; i < n; i++) {
+    if (b[i].count == 0 || b[i].index > newest || newest - b[i].index >= count) continue;
+    if (stats->count == 0 || b[i].min < stats->min) stats->min = b[i].min;
+    if (stats->count == 0 || b[i].max > stats->max) stats->max = b[i].max;
+    stats->count += b[i].count;
+    *sum += b[i].sum;
+  }
+}
+
+bool TimeSeries::getStats(time_t t, uint32_t window_sec, Stats *stats) {
+  int32_t sum = 0;
+  stats->count = 0;
+  stats->min = stats->max = stats->avg = 0;
+  uint32_t minute = (uint32_t)(t / 60);
+  if (window_sec <= 3600UL) {
+    collect(buckets.minutes, minute_buckets, minute, (window_sec + 59) / 60, stats, &sum);
+  } else {
+    collect(buckets.hours, hour_buckets, minute / 60, (window_sec + 3599) / 3600, stats, &sum);
+  }
+  if (stats->count == 0) return false;
+  stats->avg = (int16_t)((sum + (sum < 0 ? -(int32_t)stats->count : (int32_t)stats->count) / 2) / (int32_t)stats->count);
+  return true;
+}
+
+int TimeSeries::report(char *buf, size_t size, time_t t) {
+  const static struct { const char *name; uint32_t sec; } windows[] = {
+    { "1m", 60 }, { "15m", 900 }, { "1h", 3600 }, { "24h", 86400 }
+  };
+  int len = snprintf(buf, size, "{\"scale\":%u", scale);
+  for (uint8_t i = 0; i < sizeof(windows) / sizeof(windows[0]) && len > 0 && (size_t)len < size; i++) {
+    Stats s;
+    if (getStats(t, windows[i].sec, &s)) {
+      len += snprintf(buf + len, size - len, ",\"%s\":[%d,%d,%d]", windows[i].name, s.min, s.max, s.avg);
+    } else {
+      len += snprintf(buf + len, size - len, ",\"%s\":null", windows[i].name);
+    }
+  }
+  if (len > 0 && (size_t)len < size) {
+    len += snprintf(buf + len, size - len, "}");
+  }
+  return len;
+}
@@ -0,0 +1,68 @@
+#ifndef TIME_SERIES_H
+#define TIME_SERIES_H
+
+/*
+ * Fixed size history of a sensor reading, for trends without keeping every value.
+ *
+ * Readings go into one bucket per minute (the last hour) and one per hour (the last day). A bucket
+ * keeps min, max, sum and count, so statistics over any window are exact, not averages of averages.
+ * Buckets carry their minute/hour number since 1970: after a gap (or a reboot) old buckets are
+ * recognized and skipped, nothing has to be shifted. No allocation.
+ *
+ * Values are integers in whatever fixed point unit the caller uses (e.g. 1/100 C); report() says so.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+class TimeSeries {
+public:
+  TimeSeries(uint16_t scale=1) : scale(scale) { clear(); }
+
+  const static uint8_t minute_buckets = 60;
+  const static uint8_t hour_buckets = 24;
+
+  struct Stats {
+    int16_t  min, max, avg;
+    uint16_t count;
+  };
+
+  void clear();
+  // Returns true when this reading started a new hour, a good moment to save().
+  bool add(time_t t, int16_t value);
+  // Over the window_sec before t; minute buckets up to an hour, hour buckets above. False if there are no readings.
+  bool getStats(time_t t, uint32_t window_sec, Stats *stats);
+  // Compact JSON, [min,max,avg] for the last minute, 15 minutes, hour and day: {"scale":100,"1m":[2301,2310,2305],...}
+  int report(char *buf, size_t size, time_t t);
+
+  // Raw storage, for persisting it as one blob. Check isValid() after loading into it.
+  void *data()       { return &buckets; }
+  size_t dataSize()  { return sizeof(buckets); }
+  bool isValid()     { return buckets.magic == magic; }
+
+private:
+  struct Bucket {
+    uint32_t index;  // minute or hour since 1970
+    int32_t  sum;
+    int16_t  min, max;
+    uint16_t count;
+    uint16_t reserved;
+  };
+  // Saved as a blob, outside StoredConfig's schema versions: a change of Bucket or of the bucket counts
+  // must bump the version, or a saved history loads as garbage. The static_assert is the reminder.
+  const static uint32_t magic = 0x01535454;  // "TTS", version 1
+  struct {
+    uint32_t magic;
+    Bucket minutes[minute_buckets];
+    Bucket hours[hour_buckets];
+  } buckets;
+  static_assert(sizeof(Bucket) == 16 && sizeof(buckets) == 4 + (60 + 24) * 16,
+                "TimeSeries storage layout changed: bump the version in magic, then update this check");
+  uint16_t scale;
+
+  static void addTo(Bucket &b, uint32_t index, int16_t value);
+  static void collect(const Bucket *b, uint8_t n, uint32_t newest, uint32_t count, Stats *stats, int32_t *sum);
+};
+
+#endif // TIME_SERIES_H
@@ -0,0 +1,222 @@
+#include "TimeZone.h"
+
+// Days since 1970-01-01 for a date in the proleptic Gregorian calendar.
+// http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+static int32_t daysFromCivil(int32_t y, uint32_t m, uint32_t d) {
+  y -= m <= 2;
+  const int32_t era = (y >= 0 ? y : y - 399) / 400;
+  const uint32_t yoe = (uint32_t)(y - era * 400);
+  const uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+// Year of the given day since 1970-01-01.
+static int32_t yearFromDays(int32_t z) {
+  z += 719468;
+  const int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const uint32_t doe = (uint32_t)(z - era * 146097);
+  const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const uint32_t mp = (5 * doy + 2) / 153;
+  return (int32_t)yoe + era * 400 + (mp >= 10);  // March-based year -> January-based
+}
+
+static bool isLeapYear(int32_t y) {
+  return (y % 4 == 0) && ((y % 100 != 0) || (y % 400 == 0));
+}
+
+// 0 = Sunday, 1970-01-01 was a Thursday.
+static uint8_t weekday(int32_t days) {
+  return (uint8_t)(((days % 7) + 11) % 7);
+}
+
+
+// --- Parser helpers. Each one advances *s past what it consumed and returns false on a syntax error.
+
+static bool parseName(const char **s) {
+  const char *p = *s;
+  if (*p == '<') {
+    p++;
+    while (*p && *p != '>') p++;
+    if (*p != '>') return false;
+    *s = p + 1;
+    return true;
+  }
+  while ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')) p++;
+  if (p - *s < 3) return false;
+  *s = p;
+  return true;
+}
+
+static bool parseNumber(const char **s, int32_t *value) {
+  const char *p = *s;
+  if (*p < '0' || *p > '9') return false;
+  int32_t v = 0;
+  while (*p >= '0' && *p <= '9') {
+    v = v * 10 + (*p - '0');
+    if (v > 9999) return false;
+    p++;
+  }
+  *value = v;
+  *s = p;
+  return true;
+}
+
+// [+-]hh[:mm[:ss]] in seconds
+static bool parseTime(const char **s, int32_t *seconds) {
+  const char *p = *s;
+  int32_t sign = 1;
+  if (*p == '+' || *p == '-') {
+    if (*p == '-') sign = -1;
+    p++;
+  }
+  int32_t h, m = 0, sec = 0;
+  if (!parseNumber(&p, &h) || h > 167) return false;
+  if (*p == ':') {
+    p++;
+    if (!parseNumber(&p, &m) || m > 59) return false;
+    if (*p == ':') {
+      p++;
+      if (!parseNumber(&p, &sec) || sec > 59) return false;
+    }
+  }
+  *seconds = sign * (h * 3600 + m * 60 + sec);
+  *s = p;
+  return true;
+}
+
+// Mm.w.d | Jn | n, with an optional /time
+bool TimeZone::parseRule(const char **s, Rule *rule) {
+  const char *p = *s;
+  int32_t a, b, c;
+  if (*p == 'M') {
+    p++;
+    if (!parseNumber(&p, &a) || a < 1 || a > 12 || *p++ != '.') return false;
+    if (!parseNumber(&p, &b) || b < 1 || b > 5  || *p++ != '.') return false;
+    if (!parseNumber(&p, &c) || c > 6) return false;
+    rule->type = rule_month_week_day; rule->month = a; rule->week = b; rule->wday = c;
+  }
+  else if (*p == 'J') {
+    p++;
+    if (!parseNumber(&p, &a) || a < 1 || a > 365) return false;
+    rule->type = rule_julian_no_leap; rule->day = a;
+  }
+  else {
+    if (!parseNumber(&p, &a) || a > 365) return false;
+    rule->type = rule_julian_zero; rule->day = a;
+  }
+  rule->time = 2 * 3600;  // default 02:00:00
+  if (*p == '/') {
+    p++;
+    if (!parseTime(&p, &rule->time)) return false;
+  }
+  *s = p;
+  return true;
+}
+
+bool TimeZone::begin(const char *posix_tz) {
+  cache_from = 1;  // empty interval forces a recalculation
+  cache_until = 0;
+  valid = parse(posix_tz);
+  if (!valid) {
+    // Don't keep what was parsed before the error; stay at UTC.
+    has_dst = false;
+    std_offset = dst_offset = 0;
+  }
+  return valid;
+}
+
+bool TimeZone::parse(const char *posix_tz) {
+  has_dst = false;
+  std_offset = dst_offset = 0;
+
+  const char *p = posix_tz;
+  int32_t posix_offset;
+  if (p == NULL || !parseName(&p) || !parseTime(&p, &posix_offset)) return false;
+  // POSIX offsets are positive west of Greenwich.
+  std_offset = -posix_offset;
+  dst_offset = std_offset;
+
+  if (*p != '\0') {
+    if (!parseName(&p)) return false;
+    has_dst = true;
+    dst_offset = std_offset + 3600;
+    if (*p != ',' && *p != '\0') {
+      if (!parseTime(&p, &posix_offset)) return false;
+      dst_offset = -posix_offset;
+    }
+    if (*p == '\0') {
+      p = ",M3.2.0,M11.1.0";  // no rules given: US rules, as glibc does
+    }
+    if (*p++ != ',') return false;
+    if (!parseRule(&p, &dst_start)) return false;
+    if (*p++ != ',') return false;
+    if (!parseRule(&p, &dst_end)) return false;
+    if (*p != '\0') return false;
+  }
+  return true;
+}
+
+// UTC time of a transition. The rule time is local time as it was before the transition.
+int64_t TimeZone::transitionTime(const Rule &rule, int32_t year, int32_t offset_before) {
+  int32_t days;
+  if (rule.type == rule_month_week_day) {
+    int32_t first = daysFromCivil(year, rule.month, 1);
+    int32_t next_month = (rule.month == 12) ? daysFromCivil(year + 1, 1, 1) : daysFromCivil(year, rule.month + 1, 1);
+    days = first + (rule.wday + 7 - weekday(first)) % 7 + (rule.week - 1) * 7;
+    while (days >= next_month) days -= 7;  // week 5 means "last"
+  }
+  else if (rule.type == rule_julian_no_leap) {
+    // J1..J365, February 29th is never counted
+    days = daysFromCivil(year, 1, 1) + rule.day - 1;
+    if (isLeapYear(year) && rule.day >= 60) days++;
+  }
+  else {
+    // 0..365, February 29th is counted
+    days = daysFromCivil(year, 1, 1) + rule.day;
+  }
+  return (int64_t)days * 86400 + rule.time - offset_before;
+}
+
+void TimeZone::calculate(time_t utc) {
+  if (!has_dst) {
+    cache_offset = std_offset;
+    cache_is_dst = false;
+    cache_from = INT64_MIN;
+    cache_until = INT64_MAX;
+    return;
+  }
+
+  // Transitions of the previous, current and next year, sorted. Covers both hemispheres and new year's eve.
+  int64_t t = utc;
+  int32_t year = yearFromDays((int32_t)((t >= 0 ? t : t - 86399) / 86400));
+  int64_t when[6];
+  bool to_dst[6];
+  uint8_t n = 0;
+  for (int32_t y = year - 1; y <= year + 1; y++) {
+    when[n] = transitionTime(dst_start, y, std_offset); to_dst[n] = true;  n++;
+    when[n] = transitionTime(dst_end,   y, dst_offset); to_dst[n] = false; n++;
+  }
+  for (uint8_t i = 1; i < n; i++) {
+    for (uint8_t j = i; j > 0 && when[j] < when[j-1]; j--) {
+      int64_t tw = when[j]; when[j] = when[j-1]; when[j-1] = tw;
+      bool td = to_dst[j]; to_dst[j] = to_dst[j-1]; to_dst[j-1] = td;
+    }
+  }
+
+  uint8_t last = 0;
+  while (last + 1 < n && when[last + 1] <= t) last++;
+  if (when[last] > t) {
+    // Before all known transitions; can't happen with a year of margin, but stay defined.
+    cache_is_dst = !to_dst[0];
+    cache_from = t;
+    cache_until = when[0];
+  }
+  else {
+    cache_is_dst = to_dst[last];
+    cache_from = when[last];
+    cache_until = (last + 1 < n) ? when[last + 1] : t + 1;
+  }
+  cache_offset = cache_is_dst ? dst_offset : std_offset;
+}
@@ -0,0 +1,60 @@
+#ifndef TIMEZONE_H
+#define TIMEZONE_H
+
+/*
+ * Offline time zone rules, from a POSIX TZ string like "CET-1CEST,M3.5.0,M10.5.0/3".
+ * Computes the UTC offset (including DST) without any network access.
+ *
+ * The offset is valid between two DST transitions. It is calculated once and cached together
+ * with the interval, so getOffset() is just a range check on every call until the next transition.
+ *
+ * Supported: <quoted> or alphabetic zone names, [+-]hh[:mm[:ss]] offsets, and Mm.w.d, Jn and n
+ * rules with an optional /time (may be negative or beyond 24h). A DST name without rules uses
+ * the US rules, like most POSIX implementations do.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+class TimeZone {
+public:
+  TimeZone() : valid(false), has_dst(false), std_offset(0), dst_offset(0),
+    cache_from(1), cache_until(0), cache_offset(0), cache_is_dst(false) {}
+
+  // Returns false if the string can't be parsed. The zone then stays at UTC.
+  bool begin(const char *posix_tz);
+  bool isValid()                          { return valid; }
+
+  // All times are UTC. The offset is in seconds east of UTC: local = utc + offset.
+  int32_t getOffset(time_t utc)           { updateCache(utc); return cache_offset; }
+  bool isDst(time_t utc)                  { updateCache(utc); return cache_is_dst; }
+  // First transition after utc; 0 if the zone has no DST.
+  time_t getNextTransition(time_t utc)    { updateCache(utc); return has_dst ? (time_t)cache_until : 0; }
+
+private:
+  enum rule_type { rule_month_week_day, rule_julian_no_leap, rule_julian_zero };
+  struct Rule {
+    uint8_t  type;
+    uint8_t  month, week, wday;  // Mm.w.d
+    uint16_t day;                // Jn, n
+    int32_t  time;               // seconds after local midnight
+  };
+
+  bool valid;
+  bool has_dst;
+  int32_t std_offset, dst_offset;
+  Rule dst_start, dst_end;
+
+  // Cached result, valid for cache_from <= t < cache_until. 64 bit, so a transition in 2038 doesn't overflow a 32 bit time_t.
+  int64_t cache_from, cache_until;
+  int32_t cache_offset;
+  bool cache_is_dst;
+
+  void updateCache(time_t utc)            { if (utc < cache_from || utc >= cache_until) calculate(utc); }
+  void calculate(time_t utc);
+  bool parse(const char *posix_tz);
+  static bool parseRule(const char **s, Rule *rule);
+  int64_t transitionTime(const Rule &rule, int32_t year, int32_t offset_before);
+};
+
+#endif // TIMEZONE_H
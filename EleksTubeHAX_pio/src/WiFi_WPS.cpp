@@ -4,9 +4,11 @@
 #include "TFTs.h"
 #include "esp_wps.h"
 #include "WiFi_WPS.h"
+#include "Metrics.h"
 
 
 #include "IPGeolocation_AO.h"
+#include <TimeLib.h>
 
 extern StoredConfig stored_config;
 
@@ -14,7 +16,18 @@ WifiState_t WifiState = disconnected;
 
 
 uint32_t TimeOfWifiReconnectAttempt = 0;
+uint32_t TimeOfWifiBegin = 0;
+bool WifiWasConnected = false;
+bool WifiTimeoutReported = false;
+volatile bool WpsRunning = false;
+bool WifiFastConnect = false;  // current attempt uses the cached BSSID and channel
 double GeoLocTZoffset = 0;
+bool GeoLocIsDst = false;
+char GeoLocTZname[StoredConfig::str_buffer_size] = "";
+
+TaskHandle_t GeoLocTaskHandle = NULL;
+volatile bool GeoLocTaskDone = false;
+volatile bool GeoLocTaskSuccess = false;
 
 
 #ifdef WIFI_USE_WPS   ////  WPS code
@@ -44,6 +57,7 @@ void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info){
       WifiState = connected;
       break;
     case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+      if (WpsRunning) break;  // WPS is still negotiating, don't touch its state
       WifiState = disconnected;
       Serial.print("WiFi lost connection. Reason: ");
       Serial.println(info.wifi_sta_disconnected.reason);
@@ -54,6 +68,7 @@ void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info){
       WifiState = wps_success;
       Serial.println("WPS Successful, stopping WPS and connecting to: " + String(WiFi.SSID()));
       esp_wifi_wps_disable();
+      WpsRunning = false;
       delay(10);
       WiFi.begin();
       break;
@@ -65,10 +80,8 @@ void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info){
       esp_wifi_wps_start(0);
       break;
     case ARDUINO_EVENT_WPS_ER_TIMEOUT:
+      // No drawing here: this runs in the WiFi event task, while loop() may be drawing the clock.
       Serial.println("WPS Timeout, retrying");
-      tfts.setTextColor(TFT_RED, TFT_BLACK);      
-      tfts.print("/");  // retry
-      tfts.setTextColor(TFT_BLUE, TFT_BLACK);
       esp_wifi_wps_disable();
       esp_wifi_wps_enable(&wps_config);
       esp_wifi_wps_start(0);
@@ -84,130 +97,190 @@ void WiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info){
 
 void WifiBegin()  {
   WifiState = disconnected;
+  WifiWasConnected = false;
+  WifiTimeoutReported = false;
+  TimeOfWifiBegin = millis();
+  TimeOfWifiReconnectAttempt = millis();
 
   WiFi.mode(WIFI_STA);
-  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);  
   WiFi.setHostname(DEVICE_NAME);  
+  WiFi.onEvent(WiFiEvent);
 
 #ifdef WIFI_USE_WPS   ////  WPS code
   // no data is saved, start WPS imediatelly
   if (stored_config.config.wifi.WPS_connected != StoredConfig::valid) {
     // Config is invalid, probably a new device never had its config written.
     Serial.println("Loaded Wifi config is invalid. Not connecting to WiFi.");
-    WiFiStartWps();  // infinite loop until connected
+    WiFiStartWps();  // runs in the background until connected
   } else {
     // data is saved, connect now
     // WiFi credentials are known, connect
-    tfts.println("Joining wifi");
-    tfts.println(stored_config.config.wifi.ssid);
     Serial.print("Joining wifi ");
     Serial.println(stored_config.config.wifi.ssid);
   
-    // https://stackoverflow.com/questions/48024780/esp32-wps-reconnect-on-power-on
-    WiFi.begin();  // use internally saved data
-    WiFi.onEvent(WiFiEvent);
-
-    unsigned long StartTime = millis();
-
-    while ((WiFi.status() != WL_CONNECTED)) {
-      delay(500);
-      tfts.print(".");
-      Serial.print(".");
-      if ((millis() - StartTime) > (WIFI_CONNECT_TIMEOUT_SEC * 1000)) {
-        Serial.println("\r\nWiFi connection timeout!");
-        tfts.println("\nTIMEOUT!");
-        WifiState = disconnected;
-        return; // exit loop, exit procedure, continue clock startup
-      }
-    }
+    WifiConnect();
   }
 #else   ////NO WPS -- Hard coded credentials
+  Serial.print("Joining wifi ");
+  Serial.println(WIFI_SSID);
 
-  WiFi.begin(WIFI_SSID, WIFI_PASSWD); 
-  WiFi.onEvent(WiFiEvent);
-  unsigned long StartTime = millis();
-  while ((WiFi.status() != WL_CONNECTED)) {
-    delay(500);
-    tfts.print(".");
-    Serial.print(".");
-    if ((millis() - StartTime) > (WIFI_CONNECT_TIMEOUT_SEC * 1000)) {
-      Serial.println("\r\nWiFi connection timeout!");
-      tfts.println("\nTIMEOUT!");
-      WifiState = disconnected;
-      return; // exit loop, exit procedure, continue clock startup
-    }
-  }
-  
+  WifiConnect();
 #endif
+  // The result arrives as ARDUINO_EVENT_WIFI_STA_GOT_IP, WifiLoop() reports it.
+}
 
- 
-  WifiState = connected;
+bool WifiLoop() {
+  if (WifiState == connected) {
+    if (WifiWasConnected) return false;
+    WifiWasConnected = true;
+    WifiTimeoutReported = false;
 
-  tfts.println("\n Connected!");
-  tfts.println(WiFi.localIP());
-  
-  Serial.println("");
-  Serial.print("Connected to ");
-  Serial.println(WiFi.SSID());
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());  
-  delay(200);
+    Serial.print("Connected to ");
+    Serial.println(WiFi.SSID());
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+    Serial.print("Time to connect (ms): ");
+    Serial.println(millis() - TimeOfWifiBegin);
+    metrics.recordWifiConnect(millis() - TimeOfWifiReconnectAttempt, WifiFastConnect);
+    WifiFastConnect = false;  // attempt is over; the fallback below must not fire on a later drop
+    WifiLinkStore();
+
+#ifdef WIFI_USE_WPS   ////  WPS code
+    if (stored_config.config.wifi.WPS_connected != StoredConfig::valid) {
+      // Connected through WPS. Saving to flash is done here, not in the event handler.
+      Serial.print("Saving config.");
+      snprintf(stored_config.config.wifi.ssid, sizeof(stored_config.config.wifi.ssid), "%s", WiFi.SSID().c_str());
+      sprintf(stored_config.config.wifi.password, ""); // can't save a password from WPS
+      stored_config.config.wifi.WPS_connected = StoredConfig::valid;
+      stored_config.save();
+      Serial.println(" WPS finished."); 
+    }
+#endif
+    return true;
+  }
+
+  if (WifiWasConnected) {
+    // lost the connection; time the reconnect from here
+    WifiWasConnected = false;
+    TimeOfWifiBegin = millis();
+  }
+  if (WifiFastConnect && (WifiState == disconnected) && !WpsRunning &&
+      ((millis() - TimeOfWifiReconnectAttempt) > WIFI_FAST_CONNECT_TIMEOUT_MS)) {
+    // AP moved to another channel, was replaced, ... Forget it (until the next good connection) and scan.
+    Serial.println("Fast WiFi connect failed, scanning.");
+    stored_config.wifi_link.is_valid = 0;
+    WiFi.disconnect();
+    WifiConnect();
+  }
+  if (!WifiTimeoutReported && !WpsRunning && ((millis() - TimeOfWifiBegin) > (WIFI_CONNECT_TIMEOUT_SEC * 1000))) {
+    // Not fatal, the clock runs from the RTC and we keep trying.
+    Serial.println("\r\nWiFi connection timeout!");
+    WifiTimeoutReported = true;
+  }
+  WifiReconnect(); // if not connected attempt to reconnect
+  return false;
 }
 
 void WifiReconnect() {
-  if ((WifiState == disconnected) && ((millis() - TimeOfWifiReconnectAttempt) > WIFI_RETRY_CONNECTION_SEC * 1000)) {
+  if ((WifiState == disconnected) && !WpsRunning && ((millis() - TimeOfWifiReconnectAttempt) > WIFI_RETRY_CONNECTION_SEC * 1000)) {
     Serial.println("Attempting WiFi reconnection...");
-    WiFi.reconnect();
-    TimeOfWifiReconnectAttempt = millis();
+    WifiConnect();
   }    
 }
 
+// Joins the AP. With a cached link, directly on the known BSSID and channel: no scan, ~1 s faster.
+// With WIFI_REUSE_IP_LEASE also with the last IP address: no DHCP.
+void WifiConnect() {
+  TimeOfWifiReconnectAttempt = millis();
+  StoredConfig::WifiLink *link = &stored_config.wifi_link;
+  WifiFastConnect = (link->is_valid == StoredConfig::valid);
+
+#ifdef WIFI_USE_WPS   ////  WPS code
+  // https://stackoverflow.com/questions/48024780/esp32-wps-reconnect-on-power-on
+  // WPS doesn't give us the password, but the WiFi driver keeps it.
+  wifi_config_t wifi_config;
+  esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+  char ssid[sizeof(wifi_config.sta.ssid) + 1];
+  char password[sizeof(wifi_config.sta.password) + 1];
+  snprintf(ssid, sizeof(ssid), "%.*s", (int)sizeof(wifi_config.sta.ssid), (char *)wifi_config.sta.ssid);
+  snprintf(password, sizeof(password), "%.*s", (int)sizeof(wifi_config.sta.password), (char *)wifi_config.sta.password);
+#else
+  const char *ssid = WIFI_SSID;
+  const char *password = WIFI_PASSWD;
+#endif
+
+  if (WifiFastConnect) {
+#ifdef WIFI_REUSE_IP_LEASE
+    WiFi.config(IPAddress(link->ip), IPAddress(link->gateway), IPAddress(link->subnet), IPAddress(link->dns));
+#else
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+#endif
+    WiFi.begin(ssid, password, link->channel, link->bssid);
+  }
+  else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.begin(ssid, password);
+  }
+}
+
+// Remembers the current connection for WifiConnect(). Written to flash only if it changed.
+void WifiLinkStore() {
+  uint8_t *bssid = WiFi.BSSID();
+  if (bssid == NULL) return;
+  StoredConfig::WifiLink link;
+  memset(&link, 0, sizeof(link));
+  link.ip = WiFi.localIP();
+  link.gateway = WiFi.gatewayIP();
+  link.subnet = WiFi.subnetMask();
+  link.dns = WiFi.dnsIP();
+  memcpy(link.bssid, bssid, sizeof(link.bssid));
+  link.channel = WiFi.channel();
+  link.is_valid = StoredConfig::valid;
+  if (memcmp(&link, &stored_config.wifi_link, sizeof(link)) != 0) {
+    stored_config.wifi_link = link;
+    stored_config.saveWifiLink();
+    Serial.println("WiFi link saved.");
+  }
+}
+
 #ifdef WIFI_USE_WPS   ////  WPS code
 void WiFiStartWps() {
   // erase settings
   sprintf(stored_config.config.wifi.ssid, ""); 
   sprintf(stored_config.config.wifi.password, ""); 
   stored_config.config.wifi.WPS_connected = 0x11; // invalid = different than 0x55
+  stored_config.wifi_link.is_valid = 0;  // probably a different network
   Serial.print("Saving config.");
   stored_config.save();
+  stored_config.saveWifiLink();
   Serial.println(" Done.");
-   
-  tfts.setTextColor(TFT_GREEN, TFT_BLACK);
-  tfts.println("WPS STARTED!");
-  tfts.setTextColor(TFT_RED, TFT_BLACK);
-  tfts.println("PRESS WPS BUTTON ON THE ROUTER");
 
+  // Before the disconnect: its event must not start a reconnect that races WPS.
+  WifiState = wps_active;
+  WpsRunning = true;
   //disconnect from wifi first if we were connected
   WiFi.disconnect(true, true);
   
-  WifiState = wps_active;
-  WiFi.onEvent(WiFiEvent);
-  WiFi.mode(WIFI_MODE_STA);
+  TimeOfWifiBegin = millis();
+  WiFi.mode(WIFI_MODE_STA);  // WiFiEvent() is already registered by WifiBegin()
 
   Serial.println("Starting WPS");
 
   wpsInitConfig();
   esp_wifi_wps_enable(&wps_config);
   esp_wifi_wps_start(0);  
+  // Returns right away; WiFiEvent() restarts WPS on timeout and WifiLoop() saves the config once connected.
+}
 
-
-  // loop until connected
-  tfts.setTextColor(TFT_BLUE, TFT_BLACK);
-  while (WifiState != connected) {
-    delay(2000);
-    tfts.print(".");
-    Serial.print(".");
-  }
+// Separate from WiFiStartWps(), so the caller can draw it after clearing the screen.
+void WiFiShowWpsPrompt() {
+  tfts.clear();  // all displays
+  tfts.setCursor(0, 0, 4);  // Font 4. 26 pixel high
+  tfts.setTextColor(TFT_GREEN, TFT_BLACK);
+  tfts.println("WPS STARTED!");
+  tfts.setTextColor(TFT_RED, TFT_BLACK);
+  tfts.println("PRESS WPS BUTTON ON THE ROUTER");
   tfts.setTextColor(TFT_WHITE, TFT_BLACK);
-  Serial.print("Saving config.");
-  sprintf(stored_config.config.wifi.ssid, "%s", WiFi.SSID()); 
-//   memset(stored_config.config.wifi.ssid, '\0', sizeof(stored_config.config.wifi.ssid));
-//   strcpy(stored_config.config.wifi.ssid, WiFi.SSID()); 
-     
-  sprintf(stored_config.config.wifi.password, ""); // can't save a password from WPS
-  stored_config.config.wifi.WPS_connected = StoredConfig::valid;
-  stored_config.save();
-  Serial.println(" WPS finished."); 
 }
 #endif
 
@@ -228,9 +301,54 @@ bool GetGeoLocationTimeZoneOffset() {
     Serial.println(String("Geo TZ Offset: ") + String(IPG.offset));  // we are interested in this one, type = double
     Serial.println(String("Geo Current Time: ") + String(IPG.current_time)); // currently not used
     GeoLocTZoffset = IPG.offset;
+    GeoLocIsDst = IPG.is_dst;
+    snprintf(GeoLocTZname, sizeof(GeoLocTZname), "%s", IPG.tz.c_str());
     return true;
   } else {
     Serial.println("Geolocation failed.");    
     return false;
   }
 }
+
+bool GeoLocCacheIsFresh() {
+  if (stored_config.geoloc.is_valid != StoredConfig::valid) return false;
+  time_t age = now() - stored_config.geoloc.timestamp;
+  // negative age: clock was wrong when the result was stored (or is now)
+  return (age >= 0) && (age < GEOLOCATION_CACHE_TTL_HOURS * 3600L);
+}
+
+void GeoLocCacheStore() {
+  snprintf(stored_config.geoloc.tz, sizeof(stored_config.geoloc.tz), "%s", GeoLocTZname);
+  stored_config.geoloc.offset = GeoLocTZoffset;
+  stored_config.geoloc.is_dst = GeoLocIsDst;
+  stored_config.geoloc.timestamp = now();
+  stored_config.geoloc.is_valid = StoredConfig::valid;
+  stored_config.saveGeoloc();
+}
+
+void GeoLocTask(void *parameter) {
+  // Registered by the task itself: from the creator it could come after a quick exit and leave a stale handle.
+  metrics.registerTask(Metrics::task_geoloc, xTaskGetCurrentTaskHandle());
+  GeoLocTaskSuccess = GetGeoLocationTimeZoneOffset();
+  metrics.recordTaskExit(Metrics::task_geoloc);
+  GeoLocTaskDone = true;
+  vTaskDelete(NULL);
+}
+
+bool GeoLocStartUpdate() {
+  if (GeoLocTaskHandle != NULL) return false;  // still running
+  GeoLocTaskDone = false;
+  // 8 kB of stack, same as the Arduino loop task where this used to run.
+  if (xTaskCreate(GeoLocTask, "geoloc", 8192, NULL, 1, &GeoLocTaskHandle) != pdPASS) {
+    GeoLocTaskHandle = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool GeoLocUpdateFinished(bool *success) {
+  if ((GeoLocTaskHandle == NULL) || !GeoLocTaskDone) return false;
+  GeoLocTaskHandle = NULL;
+  *success = GeoLocTaskSuccess;
+  return true;
+}
@@ -4,13 +4,26 @@
 #include "GLOBAL_DEFINES.h"
 
 enum WifiState_t {disconnected, connected, wps_active, wps_success, wps_failed, num_states};
+// None of these block. Connecting and WPS run in the background, driven by WiFi events.
 void WifiBegin();
 void WiFiStartWps();
+void WiFiShowWpsPrompt();
 void WifiReconnect();
+void WifiConnect();    // fast, to the cached BSSID and channel if there is one; otherwise with a full scan
+void WifiLinkStore();
+bool WifiLoop();  // call from loop(); true once, every time the connection (re)established
 
 extern WifiState_t WifiState;
 
 bool GetGeoLocationTimeZoneOffset();
 extern double GeoLocTZoffset;
 
+// Cached geolocation result, see StoredConfig::geoloc
+bool GeoLocCacheIsFresh();
+void GeoLocCacheStore();
+
+// Runs GetGeoLocationTimeZoneOffset() in a background task, so the TLS connection doesn't block loop().
+bool GeoLocStartUpdate();
+bool GeoLocUpdateFinished(bool *success);  // true once, when the background query is done
+
 #endif // WIFI_WPS_H
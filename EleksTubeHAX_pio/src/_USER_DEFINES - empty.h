@@ -38,6 +38,13 @@
 #define WIFI_USE_WPS                  //uncomment to use WPS instead of hard coded wifi credentials 
 #define WIFI_SSID      "__enter_your_wifi_ssid_here__"       // not needed if WPS is used
 #define WIFI_PASSWD    "__enter_your_wifi_password_here__"   // not needed if WPS is used.  Caution - Hard coded password is stored as clear text in BIN file
+//#define WIFI_REUSE_IP_LEASE   // reconnect with the last DHCP address, skipping DHCP. Only if the router always gives the clock the same address!
+
+
+//  *************  Time zone  *************
+// POSIX TZ string: UTC offset and DST rules are calculated on the clock, no network needed. Replaces Geolocation below.
+// Examples: "CET-1CEST,M3.5.0,M10.5.0/3" (Central Europe), "GMT0BST,M3.5.0/1,M10.5.0" (UK), "EST5EDT,M3.2.0,M11.1.0" (US Eastern)
+//#define TIME_ZONE_POSIX "CET-1CEST,M3.5.0,M10.5.0/3"
 
 
 //  *************  Geolocation  *************
@@ -53,10 +60,13 @@
 #define MQTT_USERNAME "__enter_your_username_here__"             // Username from Smartnest
 #define MQTT_PASSWORD "__enter_your_api_key_here__"              // Password from Smartnest or API key (under MY Account)
 #define MQTT_CLIENT "__enter_your_device_id_here__"              // Device Id from Smartnest
+//#define MQTT_REPORT_JSON  // report status as one JSON message on "report/state" instead of separate topics (not understood by Smartnest)
 
 
 // ************* Optional temperature sensor *************
 //#define ONE_WIRE_BUS_PIN   4  // DS18B20 connected to GPIO4; comment this line if sensor is not connected
+//#define TEMPERATURE_FAHRENHEIT  // show and report the temperature in F instead of C (the history stays in C)
+//#define TEMPERATURE_HISTORY_PERSIST  // keep the temperature history ("report/temperatureHistory") over a reboot; one flash write per hour
 
 
 #endif  // USER_DEFINES_H_
@@ -17,50 +17,47 @@
 #include "WiFi_WPS.h"
 #include "Mqtt_client_ips.h"
 #include "TempSensor_inc.h"
-#ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-// #include "Gestures.h"
-//TODO put into class
-#include <Wire.h>
-#include <SparkFun_APDS9960.h>
-#endif //NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+#include "Metrics.h"
+#include "Gestures.h"
 
 // Constants
 
 // Global Variables
-#ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-//TODO put into class
-SparkFun_APDS9960 apds      = SparkFun_APDS9960();
-//interupt signal for gesture sensor
-int volatile      isr_flag  = 0;
-#endif //NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-
 Backlights    backlights;
 Buttons       buttons;
 TFTs          tfts;
 Clock         uclock;
 Menu          menu;
 StoredConfig  stored_config;
+Metrics       metrics;
+#ifdef HARDWARE_NovelLife_SE_CLOCK
+Gestures      gestures;
+#endif
+TFT_eSprite   menu_sprite(&tfts);  // menu text, drawn off-screen and pushed to the hours tens display in one go
 
 bool          FullHour        = false;
 uint8_t       hour_old        = 255;
 bool          DstNeedsUpdate  = false;
 uint8_t       yesterday       = 0;
+#ifdef GEOLOCATION_ENABLED
+bool          GeoLocUpdatePending = false;
+uint32_t      GeoLocLastAttempt   = 0;
+#endif
 
 // Helper function, defined below.
 void updateClockDisplay(TFTs::show_t show=TFTs::yes);
 void setupMenu(void);
+void pushMenu(void);
 void EveryFullHour(bool loopUpdate=false);
 void UpdateDstEveryNight(void);
-#ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-void GestureStart();
-void HandleGestureInterupt(void); //only for NovelLife SE
-void GestureInterruptRoutine(void); //only for NovelLife SE
-void HandleGesture(void); //only for NovelLife SE
-#endif //NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+#ifdef GEOLOCATION_ENABLED
+void UpdateGeolocationInBackground(void);
+#endif
 
 void setup() {
+  // No waiting anywhere in here: the goal is correct digits on the displays within ~500 ms of reset.
+  // WiFi connects in the background (on the other core) while the displays and the clock start up.
   Serial.begin(115200);
-  delay(1000);  // Waiting for serial monitor to catch up.
   Serial.println("");
   Serial.println(FIRMWARE_VERSION);
   Serial.println("In setup().");  
@@ -72,53 +69,39 @@ void setup() {
   buttons.begin();
   menu.begin();
 
-#ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-  //Init the Gesture sensor
-  tfts.println("Gesture sensor start");
-  GestureStart(); //TODO put into class
-#endif
-
-  // Setup the displays (TFTs) initaly and show bootup message(s)
-  tfts.begin();  // and count number of clock faces available
+  // Setup the displays (TFTs) and count number of clock faces available
+  tfts.begin();
+  backlights.loadProgramFile(BACKLIGHTS_PROGRAM_FILE);  // needs SPIFFS, mounted by tfts.begin()
   tfts.fillScreen(TFT_BLACK);
   tfts.setTextColor(TFT_WHITE, TFT_BLACK);
   tfts.setCursor(0, 0, 2);  // Font 2. 16 pixel high
-  tfts.println("setup...");
 
-  // Setup WiFi connection. Must be done before setting up Clock.
+#ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+  gestures.begin();
+#endif
+
+  // Start connecting to WiFi. This returns right away, the connection comes up in the background.
   // This is done outside Clock so the network can be used for other things.
 //  WiFiBegin(&stored_config.config.wifi);
-  tfts.println("WiFi start");
+  Serial.println("WiFi start");
   WifiBegin();
-  
-  // wait for a bit before querying NTP
-  for (uint8_t ndx=0; ndx < 5; ndx++) {
-    tfts.print(">");
-    delay(100);
-  }
-  tfts.println("");
 
-  // Setup the clock.  It needs WiFi to be established already.
-  tfts.println("Clock start");
+  // Setup the clock. Runs from the RTC until WiFi is up, then syncs to NTP.
+  Serial.println("Clock start");
   uclock.begin(&stored_config.config.uclock);
 
-  // Setup MQTT
-  tfts.println("MQTT start");
-  MqttStart();
+  // Reads the temperature sensor (if present) in the background.
+  StartTemperatureSensor();
 
 #ifdef GEOLOCATION_ENABLED
-  tfts.println("Geoloc query");
-  if (GetGeoLocationTimeZoneOffset()) {
-    tfts.print("TZ: ");
-    tfts.println(GeoLocTZoffset);
-    uclock.setTimeZoneOffset(GeoLocTZoffset * 3600);
-    Serial.print("Saving config...");
-    stored_config.save();
-    Serial.println(" Done.");
-  } else {
-    Serial.println("Geolocation failed.");    
-    tfts.println("Geo FAILED");
+  // Use the stored result right away, so the first frame already shows local time.
+  // Query again (in the background, from loop()) only if it is too old.
+  if (stored_config.geoloc.is_valid == StoredConfig::valid) {
+    Serial.print("Stored TZ offset: ");
+    Serial.println(stored_config.geoloc.offset);
+    uclock.setTimeZoneOffset(stored_config.geoloc.offset * 3600);
   }
+  GeoLocUpdatePending = !GeoLocCacheIsFresh();
 #endif
 
   if (uclock.getActiveGraphicIdx() > tfts.NumberOfClockFaces) {
@@ -127,25 +110,32 @@ void setup() {
   }
   tfts.current_graphic = uclock.getActiveGraphicIdx();
 
-  tfts.println("Done with setup.");
-
-  // Leave boot up messages on screen for a few seconds.
-  for (uint8_t ndx=0; ndx < 10; ndx++) {
-    tfts.print(">");
-    delay(200);
-  }
-
   // Start up the clock displays.
   tfts.fillScreen(TFT_BLACK);
   uclock.loop();
   updateClockDisplay(TFTs::force);
+#ifdef WIFI_USE_WPS
+  // First boot: WifiBegin() started WPS, but the fillScreen() above would have wiped its prompt.
+  if (WifiState == wps_active) WiFiShowWpsPrompt();
+#endif
+  uint32_t time_to_first_frame = millis();  // millis() counts from reset
+  metrics.recordBootTime(time_to_first_frame);
+  Serial.print("Time to first frame (ms): ");
+  Serial.println(time_to_first_frame);
+
+  // Setup MQTT. Connects from its own task once WiFi is up.
+  Serial.println("MQTT start");
+  MqttStart();
+
   Serial.println("Setup finished.");
 }
 
 void loop() {
   uint32_t millis_at_top = millis();
   // Do all the maintenance work
-  WifiReconnect(); // if not connected attempt to reconnect
+  if (WifiLoop()) { // connection state machine, reconnects if needed
+    uclock.requestNtpSync();  // just (re)connected, don't wait for the next hourly sync
+  }
 
   MqttStatusPower = tfts.isEnabled();
   MqttStatusState = (uclock.getActiveGraphicIdx()+1) * 5;   // 10 
@@ -164,6 +154,7 @@ void loop() {
     } else {
       tfts.disableAllDisplays();
       backlights.PowerOff();
+      stored_config.save();  // the clock may get unplugged next; write what saveLater() is holding back
     }
   }
 
@@ -181,18 +172,21 @@ void loop() {
     uclock.setClockGraphicsIdx(idx);  
     tfts.current_graphic = uclock.getActiveGraphicIdx();
     updateClockDisplay(TFTs::force);   // redraw everything
-    /* do not save to flash everytime mqtt changes; can be frequent
-    Serial.print("Saving config...");
-    stored_config.save();
-    Serial.println(" Done.");
-    */
+    stored_config.saveLater();  // can be frequent; a burst of changes is one flash write
   }
 
-  buttons.loop();
+  if (MqttCommandProgramReceived) {
+    MqttCommandProgramReceived = false;
+    if (backlights.loadProgram(MqttCommandProgram, MqttCommandProgramLength)) {
+      backlights.saveProgramFile(BACKLIGHTS_PROGRAM_FILE);
+      backlights.setPattern(Backlights::program);
+    }
+  }
 
 #ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-  HandleGestureInterupt();
+  gestures.loop(buttons);  // Must be called before buttons.loop()
 #endif // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+  buttons.loop();
 
   // Power button: If in menu, exit menu. Else turn off displays and backlight.
   if (buttons.power.isDownEdge() && (menu.getState() == Menu::idle)) {
@@ -210,11 +204,14 @@ void loop() {
       updateClockDisplay(TFTs::force);
     }
     backlights.togglePower();
+    if (!tfts.isEnabled()) {
+      stored_config.save();  // same as the MQTT power off
+    }
   }
  
   menu.loop(buttons);  // Must be called after buttons.loop()
-  backlights.loop();
   uclock.loop();
+  stored_config.loop();
 
   EveryFullHour(true); // night or daytime
 
@@ -227,13 +224,12 @@ void loop() {
   if (menu.stateChanged() && tfts.isEnabled()) {
     Menu::states menu_state = menu.getState();
     int8_t menu_change = menu.getChange();
+    uint32_t input_ms = buttons.millisAtDownEdge();  // 0 if the menu timed out
 
     if (menu_state == Menu::idle) {
       // We just changed into idle, so force redraw everything, and save the config.
       updateClockDisplay(TFTs::force);
-      Serial.print("Saving config...");
-      stored_config.save();
-      Serial.println(" Done.");
+      stored_config.saveLater();
     }
     else {
       // Backlight Pattern
@@ -243,8 +239,8 @@ void loop() {
         }
 
         setupMenu();
-        tfts.println("Pattern:");
-        tfts.println(backlights.getPatternStr());
+        menu_sprite.println("Pattern:");
+        menu_sprite.println(backlights.getPatternStr());
       }
       // Backlight Color
       else if (menu_state == Menu::pattern_color) {
@@ -252,8 +248,8 @@ void loop() {
           backlights.adjustColorPhase(menu_change*16);
         }
         setupMenu();
-        tfts.println("Color:");
-        tfts.printf("%06X\n", backlights.getColor()); 
+        menu_sprite.println("Color:");
+        menu_sprite.printf("%06X\n", backlights.getColor()); 
       }
       // Backlight Intensity
       else if (menu_state == Menu::backlight_intensity) {
@@ -261,8 +257,8 @@ void loop() {
           backlights.adjustIntensity(menu_change);
         }
         setupMenu();
-        tfts.println("Intensity:");
-        tfts.println(backlights.getIntensity());
+        menu_sprite.println("Intensity:");
+        menu_sprite.println(backlights.getIntensity());
       }
       // 12 Hour or 24 Hour mode?
       else if (menu_state == Menu::twelve_hour) {
@@ -273,8 +269,8 @@ void loop() {
         }
         
         setupMenu();
-        tfts.println("Hour format");
-        tfts.println(uclock.getTwelveHour() ? "12 hour" : "24 hour"); 
+        menu_sprite.println("Hour format");
+        menu_sprite.println(uclock.getTwelveHour() ? "12 hour" : "24 hour"); 
       }
       // Blank leading zeros on the hours?
       else if (menu_state == Menu::blank_hours_zero) {
@@ -284,8 +280,8 @@ void loop() {
         }
         
         setupMenu();
-        tfts.println("Blank zero?");
-        tfts.println(uclock.getBlankHoursZero() ? "yes" : "no");
+        menu_sprite.println("Blank zero?");
+        menu_sprite.println(uclock.getBlankHoursZero() ? "yes" : "no");
       }
       // UTC Offset, hours
       else if (menu_state == Menu::utc_offset_hour) {
@@ -299,15 +295,15 @@ void loop() {
         }
 
         setupMenu();
-        tfts.println("UTC Offset");
-        tfts.println(" +/- Hour");
+        menu_sprite.println("UTC Offset");
+        menu_sprite.println(" +/- Hour");
         time_t offset = uclock.getTimeZoneOffset();
         int8_t offset_hour = offset/3600;
         int8_t offset_min = (offset%3600)/60;
         if(offset_min < 0) {
           offset_min = -offset_min;
         }
-        tfts.printf("%d:%02d\n", offset_hour, offset_min);
+        menu_sprite.printf("%d:%02d\n", offset_hour, offset_min);
       }
       // UTC Offset, 15 minutes
       else if (menu_state == Menu::utc_offset_15m) {
@@ -323,15 +319,15 @@ void loop() {
         }
 
         setupMenu();
-        tfts.println("UTC Offset");
-        tfts.println(" +/- 15m");
+        menu_sprite.println("UTC Offset");
+        menu_sprite.println(" +/- 15m");
         time_t offset = uclock.getTimeZoneOffset();
         int8_t offset_hour = offset/3600;
         int8_t offset_min = (offset%3600)/60;
         if(offset_min < 0) {
           offset_min = -offset_min;
         }
-        tfts.printf("%d:%02d\n", offset_hour, offset_min);
+        menu_sprite.printf("%d:%02d\n", offset_hour, offset_min);
       }
       // select clock "font"
       else if (menu_state == Menu::selected_graphic) {
@@ -345,9 +341,9 @@ void loop() {
         }
 
         setupMenu();
-        tfts.println("Selected");
-        tfts.println(" graphic:");
-        tfts.printf("    %d\n", uclock.getActiveGraphicIdx());
+        menu_sprite.println("Selected");
+        menu_sprite.println(" graphic:");
+        menu_sprite.printf("    %d\n", uclock.getActiveGraphicIdx());
       }
      
 
@@ -360,16 +356,21 @@ void loop() {
             tfts.clear();
             tfts.fillScreen(TFT_BLACK);
             tfts.setTextColor(TFT_WHITE, TFT_BLACK);
-            tfts.setCursor(0, 0, 4);  // Font 4. 26 pixel high
             WiFiStartWps();
+            WiFiShowWpsPrompt();
           }
         }
         
         setupMenu();
-        tfts.println("Connect to WiFi?");
-        tfts.println("Left=WPS");
+        menu_sprite.println("Connect to WiFi?");
+        menu_sprite.println("Left=WPS");
       }
 #endif   
+      pushMenu();
+    }
+    // Button edge to the last pixel sent; the display shows it from there on.
+    if (input_ms != 0) {
+      metrics.recordInputLatency(millis() - input_ms);
     }
   }
 
@@ -388,13 +389,14 @@ void loop() {
         bTemperatureUpdated = false;
       }
       
+#ifdef GEOLOCATION_ENABLED
       // run once a day (= 744 times per month which is below the limit of 5k for free account)
       if (DstNeedsUpdate) { // Daylight savings time changes at 3 in the morning
-        if (GetGeoLocationTimeZoneOffset()) {
-          uclock.setTimeZoneOffset(GeoLocTZoffset * 3600);
-          DstNeedsUpdate = false;  // done for this night; retry if not sucessfull
-        }
-      }  
+        GeoLocUpdatePending = true;
+        DstNeedsUpdate = false;
+      }
+      UpdateGeolocationInBackground();
+#endif
       // Sleep for up to 20ms, less if we've spent time doing stuff above.
       time_in_loop = millis() - millis_at_top;
       if (time_in_loop < 20) {
@@ -402,6 +404,7 @@ void loop() {
       }
     }
   }
+  metrics.recordLoopTime(time_in_loop);
 #ifdef DEBUG_OUTPUT
   if (time_in_loop <= 1) Serial.print(".");
   else {
@@ -410,93 +413,21 @@ void loop() {
   }
 #endif
 }
-#ifdef HARDWARE_NovelLife_SE_CLOCK // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-void GestureStart()
-{
-    // for gesture sensor APDS9660 - Set interrupt pin on ESP32 as input
-  pinMode(GESTURE_SENSOR_INPUT_PIN, INPUT);
-
-  // Initialize interrupt service routine for interupt from APDS-9960 sensor
-  attachInterrupt(digitalPinToInterrupt(GESTURE_SENSOR_INPUT_PIN), GestureInterruptRoutine, FALLING);
-
-  // Initialize gesture sensor APDS-9960 (configure I2C and initial values)
-  if ( apds.init() ) {
-    Serial.println(F("APDS-9960 initialization complete"));
-
-    //Set Gain to 1x, bacause the cheap chinese fake APDS sensor can't handle more (also remember to extend ID check in Sparkfun libary to 0x3B!)
-    apds.setGestureGain(GGAIN_1X);
-          
-    // Start running the APDS-9960 gesture sensor engine
-    if ( apds.enableGestureSensor(true) ) {
-      Serial.println(F("Gesture sensor is now running"));
-    } else {
-      Serial.println(F("Something went wrong during gesture sensor enablimg in the APDS-9960 library!"));
-    }
-  } else {
-    Serial.println(F("Something went wrong during APDS-9960 init!"));
-  }
-}
-
-//Handle Interrupt from gesture sensor and simulate a short button press (state down_edge) of the corresponding button, if a gesture is detected 
-void HandleGestureInterupt()
-{
-  if( isr_flag == 1 ) {
-    detachInterrupt(digitalPinToInterrupt(GESTURE_SENSOR_INPUT_PIN));
-    HandleGesture();
-    isr_flag = 0;
-    attachInterrupt(digitalPinToInterrupt(GESTURE_SENSOR_INPUT_PIN), GestureInterruptRoutine, FALLING);
-  }
-  return;
-}
-
-//mark, that the Interrupt of the gesture sensor was signaled
-void GestureInterruptRoutine() {
-  isr_flag = 1;
-  return;
-}
-
-//check which gesture was detected
-void HandleGesture() { 
-    //Serial.println("->main::HandleGesture()");
-    if ( apds.isGestureAvailable() ) {
-    switch ( apds.readGesture() ) {
-      case DIR_UP:
-        buttons.left.setDownEdgeState();
-        Serial.println("Gesture detected! LEFT");
-        break;
-      case DIR_DOWN:
-        buttons.right.setDownEdgeState();
-        Serial.println("Gesture detected! RIGHT");
-        break;
-      case DIR_LEFT:
-        buttons.power.setDownEdgeState();
-        Serial.println("Gesture detected! DOWN");
-        break;
-      case DIR_RIGHT:
-        buttons.mode.setDownEdgeState();
-        Serial.println("Gesture detected! UP");
-        break;
-      case DIR_NEAR:
-        buttons.mode.setDownEdgeState();
-        Serial.println("Gesture detected! NEAR");
-        break;
-      case DIR_FAR:
-        buttons.power.setDownEdgeState();
-        Serial.println("Gesture detected! FAR");
-        break;
-      default:        
-        Serial.println("Movement detected but NO gesture detected!");
-    }
+// Lower half of the hours tens display. 1 bit per pixel, so the sprite only takes 2 kB.
+void setupMenu() {
+  if (!menu_sprite.created()) {
+    menu_sprite.setColorDepth(1);
+    menu_sprite.createSprite(135, 120);
+    menu_sprite.setBitmapColor(TFT_WHITE, TFT_BLACK);
   }
-  return;
+  menu_sprite.fillSprite(TFT_BLACK);
+  menu_sprite.setTextColor(TFT_WHITE, TFT_BLACK);
+  menu_sprite.setCursor(0, 4, 4);  // Font 4. 26 pixel high
 }
-#endif // NovelLife_SE Clone XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
 
-void setupMenu() {
+void pushMenu() {
   tfts.chip_select.setHoursTens();
-  tfts.setTextColor(TFT_WHITE, TFT_BLACK);
-  tfts.fillRect(0, 120, 135, 120, TFT_BLACK);
-  tfts.setCursor(0, 124, 4);  // Font 4. 26 pixel high
+  menu_sprite.pushSprite(0, 120);
 }
 
 bool isNightTime(uint8_t current_hour) {
@@ -550,6 +481,29 @@ void UpdateDstEveryNight() {
   }
 }
 
+#ifdef GEOLOCATION_ENABLED
+void UpdateGeolocationInBackground() {
+  bool success;
+  if (GeoLocUpdateFinished(&success)) {
+    if (success) {
+      uclock.setTimeZoneOffset(GeoLocTZoffset * 3600);
+      GeoLocCacheStore();
+      GeoLocUpdatePending = false;
+      stored_config.saveLater();
+    } else {
+      Serial.println("Geolocation failed, will retry.");
+    }
+  }
+
+  if (GeoLocUpdatePending && (WifiState == connected) &&
+      ((millis() - GeoLocLastAttempt > GEOLOCATION_RETRY_MIN * 60000UL) || (GeoLocLastAttempt == 0))) {
+    if (GeoLocStartUpdate()) {
+      GeoLocLastAttempt = millis();
+    }
+  }
+}
+#endif
+
 void updateClockDisplay(TFTs::show_t show) {
   // refresh starting on seconds
   tfts.setDigit(SECONDS_ONES, uclock.getSecondsOnes(), show);
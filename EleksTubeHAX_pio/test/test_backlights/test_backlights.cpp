@@ -0,0 +1,344 @@
+// Host tests for the backlights program playback and output stage. Run with: pio test -e native
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include "BacklightsMath.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const uint8_t num_leds = 6;
+
+// Host timing, printed; the loops run long enough to be well above the clock resolution.
+// On the host only the ratios between the parts mean something, not the absolute numbers.
+static volatile uint32_t bench_sink;
+template <typename F> static void benchmark(const char *name, uint32_t iterations, F body) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) body(i);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  char message[96];
+  snprintf(message, sizeof(message), "%s: %.1f ns", name, ns / iterations);
+  TEST_MESSAGE(message);
+}
+
+// Builds a program from keys of { ms, mask, r, g, b, brightness }.
+struct Key { uint16_t ms; uint8_t mask, r, g, b, brightness; };
+static uint16_t buildProgram(uint8_t *data, uint16_t cycle_ms, const Key *keys, uint8_t count) {
+  data[0] = 'K'; data[1] = 1; data[2] = count; data[3] = 0;
+  data[4] = cycle_ms & 0xFF; data[5] = cycle_ms >> 8;
+  for (uint8_t k = 0; k < count; k++) {
+    uint8_t *key = data + BACKLIGHTS_PROGRAM_HEADER_SIZE + k * BACKLIGHTS_PROGRAM_KEY_SIZE;
+    key[0] = keys[k].ms & 0xFF; key[1] = keys[k].ms >> 8; key[2] = keys[k].mask;
+    key[3] = keys[k].r; key[4] = keys[k].g; key[5] = keys[k].b; key[6] = keys[k].brightness;
+  }
+  return BACKLIGHTS_PROGRAM_HEADER_SIZE + count * BACKLIGHTS_PROGRAM_KEY_SIZE;
+}
+
+static uint32_t colorAt(const uint8_t *data, uint32_t ms, uint8_t led) {
+  uint32_t colors[num_leds];
+  BacklightsProgramFrame(data, ms, num_leds, colors);
+  return colors[led];
+}
+
+void test_program_validation(void) {
+  uint8_t data[64];
+  Key keys[] = { { 0, 0x01, 255, 0, 0, 255 }, { 500, 0x01, 0, 0, 255, 255 } };
+  uint16_t length = buildProgram(data, 1000, keys, 2);
+  TEST_ASSERT_TRUE(BacklightsIsValidProgram(data, length, 32, num_leds));
+  TEST_ASSERT_FALSE(BacklightsIsValidProgram(data, length - 1, 32, num_leds));  // truncated
+  TEST_ASSERT_FALSE(BacklightsIsValidProgram(data, length, 1, num_leds));       // too many keys
+
+  Key unsorted[] = { { 500, 0x01, 0, 0, 0, 255 }, { 100, 0x01, 0, 0, 0, 255 } };
+  TEST_ASSERT_FALSE(BacklightsIsValidProgram(data, buildProgram(data, 1000, unsorted, 2), 32, num_leds));
+  Key beyond_cycle[] = { { 1000, 0x01, 0, 0, 0, 255 } };
+  TEST_ASSERT_FALSE(BacklightsIsValidProgram(data, buildProgram(data, 1000, beyond_cycle, 1), 32, num_leds));
+  Key no_such_led[] = { { 0, 1 << num_leds, 0, 0, 0, 255 } };
+  TEST_ASSERT_FALSE(BacklightsIsValidProgram(data, buildProgram(data, 1000, no_such_led, 1), 32, num_leds));
+}
+
+void test_program_interpolation(void) {
+  uint8_t data[64];
+  Key keys[] = { { 0, 0x01, 0, 0, 0, 255 }, { 400, 0x01, 200, 100, 40, 255 } };
+  buildProgram(data, 0, keys, 2);
+  TEST_ASSERT_EQUAL_HEX32(0x000000, colorAt(data, 0, 0));
+  TEST_ASSERT_EQUAL_HEX32(0x643214, colorAt(data, 200, 0));  // half way
+  TEST_ASSERT_EQUAL_HEX32(0x32190A, colorAt(data, 100, 0));  // a quarter
+  TEST_ASSERT_EQUAL_HEX32(0xC86428, colorAt(data, 400, 0));
+}
+
+void test_program_brightness(void) {
+  uint8_t data[64];
+  Key keys[] = { { 0, 0x01, 255, 200, 0, 51 } };
+  buildProgram(data, 0, keys, 1);
+  TEST_ASSERT_EQUAL_HEX32(0x332800, colorAt(data, 0, 0));  // 255 * 51 / 255, 200 * 51 / 255
+}
+
+void test_program_played_once_holds(void) {
+  uint8_t data[64];
+  Key keys[] = { { 100, 0x01, 10, 0, 0, 255 }, { 300, 0x01, 90, 0, 0, 255 } };
+  buildProgram(data, 0, keys, 2);
+  TEST_ASSERT_EQUAL_HEX32(0x0A0000, colorAt(data, 0, 0));       // first key until it is reached
+  TEST_ASSERT_EQUAL_HEX32(0x320000, colorAt(data, 200, 0));
+  TEST_ASSERT_EQUAL_HEX32(0x5A0000, colorAt(data, 300, 0));
+  TEST_ASSERT_EQUAL_HEX32(0x5A0000, colorAt(data, 100000, 0));  // last key forever
+}
+
+void test_program_wraparound(void) {
+  uint8_t data[64];
+  // 1000 ms cycle; from the key at 800 back to the key at 200 takes 400 ms, across the cycle boundary.
+  Key keys[] = { { 200, 0x01, 0, 0, 0, 255 }, { 800, 0x01, 200, 0, 0, 255 } };
+  buildProgram(data, 1000, keys, 2);
+  TEST_ASSERT_EQUAL_HEX32(0x640000, colorAt(data, 500, 0));   // half way up
+  TEST_ASSERT_EQUAL_HEX32(0xC80000, colorAt(data, 800, 0));
+  TEST_ASSERT_EQUAL_HEX32(0x640000, colorAt(data, 0, 0));     // half way down, 200 ms after the last key
+  TEST_ASSERT_EQUAL_HEX32(0x960000, colorAt(data, 900, 0));   // a quarter of the way down
+  TEST_ASSERT_EQUAL_HEX32(0x320000, colorAt(data, 100, 0));   // three quarters
+  TEST_ASSERT_EQUAL(colorAt(data, 100, 0), colorAt(data, 5100, 0));  // next cycles are the same
+}
+
+void test_program_leds_independent(void) {
+  uint8_t data[64];
+  Key keys[] = { { 0, 0x03, 100, 0, 0, 255 }, { 500, 0x01, 0, 0, 0, 255 } };
+  buildProgram(data, 1000, keys, 2);
+  TEST_ASSERT_EQUAL_HEX32(0x320000, colorAt(data, 250, 0));  // LED 0 fades
+  TEST_ASSERT_EQUAL_HEX32(0x640000, colorAt(data, 250, 1));  // LED 1 has one key: constant
+  TEST_ASSERT_EQUAL_HEX32(0x000000, colorAt(data, 250, 2));  // LED 2 is in no key: off
+}
+
+void test_gamma_table(void) {
+  TEST_ASSERT_EQUAL(0, BacklightsGamma16[0]);
+  TEST_ASSERT_EQUAL(65535, BacklightsGamma16[255]);
+  for (int i = 1; i < 256; i++) {
+    TEST_ASSERT_TRUE(BacklightsGamma16[i] >= BacklightsGamma16[i - 1]);
+    TEST_ASSERT_INT_WITHIN(1, (int)lround(65535 * pow(i / 255.0, 2.2)), BacklightsGamma16[i]);
+  }
+}
+
+void test_dither_full_and_off(void) {
+  uint8_t residual = 0;
+  TEST_ASSERT_EQUAL(255, BacklightsDither(255, 255, &residual));
+  residual = 0;
+  TEST_ASSERT_EQUAL(0, BacklightsDither(0, 255, &residual));
+  TEST_ASSERT_EQUAL(0, BacklightsDither(255, 0, &residual));
+}
+
+// gamma16[v] rounds to almost nothing for small v; the product of two small values even more so.
+// They must still light the LED at least every other frame, never leave it dark.
+void test_dither_never_dark(void) {
+  for (int value = 1; value < 256; value++) {
+    for (int level = 1; level < 256; level += (level < 20) ? 1 : 17) {
+      uint8_t residual = 0;
+      uint32_t sum = 0;
+      for (int frame = 0; frame < 2; frame++) sum += BacklightsDither(value, level, &residual);
+      TEST_ASSERT_TRUE(sum >= 1);
+    }
+  }
+}
+
+// Over 256 frames the LED values add up to the linear level: no light is lost or added.
+void test_dither_average(void) {
+  for (int value = 20; value < 256; value += 7) {
+    for (int level = 20; level < 256; level += 13) {
+      uint32_t linear16 = (uint32_t(BacklightsGamma16[value]) * BacklightsGamma16[level]) >> 16;
+      if (linear16 < 128) continue;  // raised to half an LED step, see test_dither_never_dark
+      uint8_t residual = 0;
+      uint32_t sum = 0;
+      for (int frame = 0; frame < 256; frame++) sum += BacklightsDither(value, level, &residual);
+      TEST_ASSERT_UINT32_WITHIN(1, linear16, sum);
+    }
+  }
+}
+
+// Two pulses per wave, from 1 (never dark) up to 255 and back.
+void test_pulse_wave(void) {
+  TEST_ASSERT_EQUAL(1, BacklightsPulse(0));
+  TEST_ASSERT_EQUAL(255, BacklightsPulse(1u << 30));  // a quarter wave
+  TEST_ASSERT_EQUAL(1, BacklightsPulse(1u << 31));
+  TEST_ASSERT_EQUAL(255, BacklightsPulse(3u << 30));
+  for (uint32_t i = 0; i < 512; i++) {
+    TEST_ASSERT_TRUE(BacklightsPulse(i << 23) >= 1);
+    TEST_ASSERT_EQUAL(BacklightsPulse(i << 23), BacklightsPulse((i << 23) + (1u << 31)));
+  }
+}
+
+// One breath per wave, brightest a quarter wave in, dark three quarters in.
+void test_breath_wave(void) {
+  TEST_ASSERT_EQUAL(68, BacklightsBreath(0));
+  TEST_ASSERT_EQUAL(253, BacklightsBreath(1u << 30));
+  TEST_ASSERT_EQUAL(68, BacklightsBreath(1u << 31));
+  TEST_ASSERT_EQUAL(0, BacklightsBreath(3u << 30));
+  TEST_ASSERT_EQUAL(65, BacklightsBreath(0xFFFFFFFF));  // the last step, just before the wrap
+}
+
+// breath_per_min waves per minute, whatever the frame length: after a minute the wave is back where it
+// started, having wrapped around breath_per_min times.
+void test_wave_per_minute(void) {
+  const uint8_t rates[] = { 1, 10, 30, 72, 255 };
+  for (uint8_t rate : rates) {
+    BacklightsPhases by_frame = {}, at_once = {};
+    uint32_t wraps = 0;
+    for (uint32_t ms = 0; ms < 60000; ms += 20) {
+      uint32_t before = by_frame.wave;
+      BacklightsAdvancePhases(&by_frame, 20, rate);
+      if (by_frame.wave < before) wraps++;
+    }
+    BacklightsAdvancePhases(&at_once, 60000, rate);
+    TEST_ASSERT_EQUAL_UINT32(at_once.wave, by_frame.wave);
+    TEST_ASSERT_EQUAL(rate, wraps + (by_frame.wave > 0x80000000u ? 1 : 0));
+    // The step is rounded down: at most 60000 * 1 short of a whole number of waves, under 1/60000 of one.
+    TEST_ASSERT_TRUE(by_frame.wave == 0 || by_frame.wave >= 0xFFFFFFFFu - 60000);
+  }
+  // Twice the rate, twice the phase.
+  BacklightsPhases slow = {}, fast = {};
+  BacklightsAdvancePhases(&slow, 1000, 10);
+  BacklightsAdvancePhases(&fast, 1000, 20);
+  TEST_ASSERT_UINT32_WITHIN(1000, 2 * slow.wave, fast.wave);
+  TEST_ASSERT_EQUAL(slow.rainbow, fast.rainbow);  // the rainbow doesn't depend on it
+}
+
+// The rainbow goes round the color phases every 768 * 16 ms and stays within them.
+void test_rainbow_wraps(void) {
+  BacklightsPhases p = {};
+  BacklightsAdvancePhases(&p, 16, 10);
+  TEST_ASSERT_EQUAL(1, p.rainbow >> 8);
+  p = BacklightsPhases();
+  BacklightsAdvancePhases(&p, BACKLIGHTS_COLOR_PHASES * 16, 10);
+  TEST_ASSERT_EQUAL(0, p.rainbow);
+  for (uint32_t frame = 0; frame < 100000; frame++) {
+    BacklightsAdvancePhases(&p, 17, 10);
+    TEST_ASSERT_TRUE((p.rainbow >> 8) < BACKLIGHTS_COLOR_PHASES);
+  }
+}
+
+void test_benchmark_waves(void) {
+  BacklightsPhases p = {};
+  benchmark("advance phases", 10000000, [&](uint32_t i) { BacklightsAdvancePhases(&p, 20, 10); });
+  benchmark("pulse + breath lookup", 10000000, [&](uint32_t i) {
+    bench_sink = BacklightsPulse(i * 0x9E3779B9u) + BacklightsBreath(i * 0x9E3779B9u);
+  });
+  bench_sink = p.wave;
+}
+
+// Program time is kept within the cycle as it accumulates, so it never wraps around with millis()
+// (after 49 days, 2^32 ms, which is no multiple of the cycle).
+void test_program_time_over_months(void) {
+  BacklightsPhases p = {};
+  p.program_cycle_ms = 1000;
+  uint64_t total_ms = 0;
+  for (int i = 0; i < 6000; i++) {  // 70 days, in steps of 1000 s + 7 ms
+    BacklightsAdvancePhases(&p, 1000007, 10);
+    total_ms += 1000007;
+    TEST_ASSERT_EQUAL_UINT32(total_ms % 1000, p.program_ms);
+  }
+  // Played once: held at the end, where BacklightsProgramFrame shows the last keys anyway.
+  p = BacklightsPhases();
+  for (int i = 0; i < 6000; i++) BacklightsAdvancePhases(&p, 1000007, 10);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFF, p.program_ms);
+}
+
+// A frame of the largest program, and the output stage for all LEDs.
+void test_benchmark_frame(void) {
+  uint8_t data[BACKLIGHTS_PROGRAM_HEADER_SIZE + 32 * BACKLIGHTS_PROGRAM_KEY_SIZE];
+  Key keys[32];
+  for (uint8_t k = 0; k < 32; k++) {
+    keys[k] = { uint16_t(k * 300), uint8_t(0x3F >> (k % 3)), uint8_t(k * 8), 100, uint8_t(255 - k * 8), 200 };
+  }
+  buildProgram(data, 10000, keys, 32);
+  TEST_ASSERT_TRUE(BacklightsIsValidProgram(data, sizeof(data), 32, num_leds));
+  uint32_t colors[num_leds];
+  benchmark("program frame, 32 keys", 1000000, [&](uint32_t i) {
+    BacklightsProgramFrame(data, i * 20, num_leds, colors);
+    bench_sink = colors[i % num_leds];
+  });
+  BacklightsOutput output = {};
+  uint8_t rgb[num_leds * 3];
+  benchmark("output stage, 6 LEDs", 1000000, [&](uint32_t i) {
+    for (uint8_t led = 0; led < num_leds; led++) colors[led] = (i * 0x010305u + led) & 0xFFFFFF;
+    BacklightsOutputFrame(&output, colors, uint8_t(i >> 8), num_leds, rgb);
+    bench_sink = rgb[i % sizeof(rgb)];
+  });
+}
+
+void test_round(void) {
+  TEST_ASSERT_EQUAL(255, BacklightsRound(255, 255));
+  TEST_ASSERT_EQUAL(0, BacklightsRound(0, 255));
+  TEST_ASSERT_EQUAL(0, BacklightsRound(255, 0));
+  TEST_ASSERT_EQUAL(1, BacklightsRound(1, 1));  // never dark
+  TEST_ASSERT_EQUAL(128, BacklightsRound(255, 186));  // gamma16[186] = 32735: 127.9 LED steps
+}
+
+// A steady color and level give the same LED data every frame: nothing to send, nothing that flickers.
+// Low levels, where the dithering used to change the data almost every frame.
+void test_steady_frames_identical(void) {
+  const uint8_t levels[] = { 21, 34, 50, 70, 98, 135, 186, 255 };  // the intensity steps
+  uint32_t colors[num_leds] = { 0xFFFFFF, 0x808080, 0x0A0B0C, 0xFF0000, 0x010203, 0x000000 };
+  for (uint8_t level : levels) {
+    BacklightsOutput output = {};
+    uint8_t first[num_leds * 3], rgb[num_leds * 3];
+    BacklightsOutputFrame(&output, colors, level, num_leds, rgb);  // changed: dithered
+    BacklightsOutputFrame(&output, colors, level, num_leds, first);
+    for (int frame = 0; frame < 100; frame++) {
+      BacklightsOutputFrame(&output, colors, level, num_leds, rgb);
+      TEST_ASSERT_EQUAL_MEMORY(first, rgb, sizeof(rgb));
+    }
+    for (uint8_t c = 0; c < sizeof(rgb); c++) {
+      uint8_t value = colors[c / 3] >> (16 - 8 * (c % 3));
+      TEST_ASSERT_EQUAL(BacklightsRound(value, level), rgb[c]);
+    }
+  }
+}
+
+// While the level changes every frame the LEDs are dithered, as by BacklightsDither() alone.
+void test_fading_is_dithered(void) {
+  uint32_t colors[num_leds] = { 0x102030, 0x102030, 0x102030, 0x102030, 0x102030, 0x102030 };
+  BacklightsOutput output = {};
+  uint8_t residual[3] = {};
+  uint8_t rgb[num_leds * 3];
+  for (int frame = 0; frame < 200; frame++) {
+    uint8_t level = 20 + frame;  // changes every frame
+    BacklightsOutputFrame(&output, colors, level, num_leds, rgb);
+    for (uint8_t i = 0; i < 3; i++) {
+      TEST_ASSERT_EQUAL(BacklightsDither(colors[0] >> (16 - 8 * i), level, &residual[i]), rgb[i]);
+    }
+  }
+}
+
+// Steadiness is per LED: a LED that fades doesn't make the others dither.
+void test_steady_per_led(void) {
+  uint32_t colors[num_leds] = { 0x050505, 0x050505, 0x050505, 0x050505, 0x050505, 0x050505 };
+  BacklightsOutput output = {};
+  uint8_t rgb[num_leds * 3];
+  BacklightsOutputFrame(&output, colors, 34, num_leds, rgb);
+  for (int frame = 0; frame < 50; frame++) {
+    colors[0] = (frame & 1) ? 0x060606 : 0x070707;
+    BacklightsOutputFrame(&output, colors, 34, num_leds, rgb);
+    for (uint8_t c = 3; c < sizeof(rgb); c++) TEST_ASSERT_EQUAL(BacklightsRound(5, 34), rgb[c]);
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_program_validation);
+  RUN_TEST(test_program_interpolation);
+  RUN_TEST(test_program_brightness);
+  RUN_TEST(test_program_played_once_holds);
+  RUN_TEST(test_program_wraparound);
+  RUN_TEST(test_program_leds_independent);
+  RUN_TEST(test_gamma_table);
+  RUN_TEST(test_dither_full_and_off);
+  RUN_TEST(test_dither_never_dark);
+  RUN_TEST(test_dither_average);
+  RUN_TEST(test_round);
+  RUN_TEST(test_steady_frames_identical);
+  RUN_TEST(test_fading_is_dithered);
+  RUN_TEST(test_steady_per_led);
+  RUN_TEST(test_pulse_wave);
+  RUN_TEST(test_breath_wave);
+  RUN_TEST(test_wave_per_minute);
+  RUN_TEST(test_rainbow_wraps);
+  RUN_TEST(test_benchmark_waves);
+  RUN_TEST(test_program_time_over_months);
+  RUN_TEST(test_benchmark_frame);
+  return UNITY_END();
+}
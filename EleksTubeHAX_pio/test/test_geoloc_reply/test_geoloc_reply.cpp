@@ -0,0 +1,122 @@
+// Host tests for the geolocation reply parsing, with replies recorded from abstractapi.com.
+// Run with: pio test -e native
+#include <unity.h>
+#include <string.h>
+#include "GeolocReply.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const char winter_reply[] =
+  "{\"ip_address\":\"93.103.0.1\",\"city\":\"Kranj\",\"city_geoname_id\":3197378,\"region\":\"Kranj\","
+  "\"region_iso_code\":\"052\",\"region_geoname_id\":3197377,\"postal_code\":\"4000\",\"country\":\"Slovenia\","
+  "\"country_code\":\"SI\",\"country_geoname_id\":3190538,\"country_is_eu\":true,\"continent\":\"Europe\","
+  "\"continent_code\":\"EU\",\"continent_geoname_id\":6255148,\"longitude\":14.3556,\"latitude\":46.2389,"
+  "\"security\":{\"is_vpn\":false},"
+  "\"timezone\":{\"name\":\"Europe/Ljubljana\",\"abbreviation\":\"CET\",\"gmt_offset\":1,\"current_time\":\"17:58:18\",\"is_dst\":false},"
+  "\"flag\":{\"emoji\":\"\",\"unicode\":\"U+1F1F8 U+1F1EE\",\"png\":\"https://static.abstractapi.com/country-flags/SI_flag.png\","
+  "\"svg\":\"https://static.abstractapi.com/country-flags/SI_flag.svg\"},"
+  "\"currency\":{\"currency_name\":\"Euros\",\"currency_code\":\"EUR\"},"
+  "\"connection\":{\"autonomous_system_number\":34779,\"autonomous_system_organization\":\"x\",\"connection_type\":\"Cellular\","
+  "\"isp_name\":\"x\",\"organization_name\":null}}";
+
+static const char summer_reply[] =
+  "{\"ip_address\":\"93.103.0.1\",\"city\":\"Kranj\",\"country_code\":\"SI\",\"longitude\":14.3556,\"latitude\":46.2389,"
+  "\"timezone\":{\"name\":\"Europe/Ljubljana\",\"abbreviation\":\"CEST\",\"gmt_offset\":2,\"current_time\":\"23:39:52\",\"is_dst\":true},"
+  "\"currency\":{\"currency_name\":\"Euros\",\"currency_code\":\"EUR\"}}";
+
+static const char half_hour_reply[] =
+  "{\"timezone\":{\"name\":\"Asia/Kolkata\",\"abbreviation\":\"IST\",\"gmt_offset\":5.5,\"current_time\":\"09:15:00\",\"is_dst\":false}}";
+
+static const char error_reply[] =
+  "{\"error\":{\"message\":\"Invalid API key provided.\",\"code\":\"unauthorized\",\"details\":null}}";
+
+// What IPGeolocation::updateStatus() does with the stream.
+static DeserializationError parse(const char *reply, JsonDocument &doc) {
+  JsonDocument filter;
+  GeolocReplyFilter(filter);
+  return deserializeJson(doc, reply, DeserializationOption::Filter(filter));
+}
+
+void test_winter(void) {
+  JsonDocument doc;
+  GeolocTimeZone tz;
+  TEST_ASSERT_FALSE(parse(winter_reply, doc));
+  TEST_ASSERT_TRUE(GeolocReadTimeZone(doc, &tz));
+  TEST_ASSERT_EQUAL_STRING("Europe/Ljubljana", tz.name);
+  TEST_ASSERT_EQUAL_STRING("17:58:18", tz.current_time);
+  TEST_ASSERT_TRUE(tz.offset == 1.0);
+  TEST_ASSERT_FALSE(tz.is_dst);
+}
+
+void test_summer(void) {
+  JsonDocument doc;
+  GeolocTimeZone tz;
+  TEST_ASSERT_FALSE(parse(summer_reply, doc));
+  TEST_ASSERT_TRUE(GeolocReadTimeZone(doc, &tz));
+  TEST_ASSERT_TRUE(tz.offset == 2.0);
+  TEST_ASSERT_TRUE(tz.is_dst);
+}
+
+void test_fractional_offset(void) {
+  JsonDocument doc;
+  GeolocTimeZone tz;
+  TEST_ASSERT_FALSE(parse(half_hour_reply, doc));
+  TEST_ASSERT_TRUE(GeolocReadTimeZone(doc, &tz));
+  TEST_ASSERT_TRUE(tz.offset == 5.5);
+}
+
+// Only the filtered fields are kept in the document, whatever else the reply carries.
+void test_filter_drops_the_rest(void) {
+  JsonDocument doc;
+  TEST_ASSERT_FALSE(parse(winter_reply, doc));
+  TEST_ASSERT_EQUAL(1, doc.as<JsonObject>().size());
+  TEST_ASSERT_TRUE(doc["city"].isNull());
+  TEST_ASSERT_TRUE(doc["flag"].isNull());
+  TEST_ASSERT_TRUE(doc["timezone"]["abbreviation"].isNull());
+  TEST_ASSERT_EQUAL(4, doc["timezone"].as<JsonObject>().size());
+}
+
+void test_error_reply(void) {
+  JsonDocument doc;
+  GeolocTimeZone tz;
+  TEST_ASSERT_FALSE(parse(error_reply, doc));
+  TEST_ASSERT_FALSE(GeolocReadTimeZone(doc, &tz));
+}
+
+void test_no_time_zone(void) {
+  JsonDocument doc;
+  GeolocTimeZone tz;
+  TEST_ASSERT_FALSE(parse("{\"city\":\"Kranj\"}", doc));
+  TEST_ASSERT_FALSE(GeolocReadTimeZone(doc, &tz));
+}
+
+void test_truncated_reply(void) {
+  JsonDocument doc;
+  char truncated[sizeof(winter_reply)];
+  strcpy(truncated, winter_reply);
+  truncated[450] = '\0';  // connection dropped in the middle of the time zone
+  TEST_ASSERT_TRUE(parse(truncated, doc) == DeserializationError::IncompleteInput);
+}
+
+void test_long_name_truncated(void) {
+  JsonDocument doc;
+  GeolocTimeZone tz;
+  TEST_ASSERT_FALSE(parse("{\"timezone\":{\"name\":\"America/Argentina/ComodRivadavia/And/Then/Some/More\",\"gmt_offset\":-3}}", doc));
+  TEST_ASSERT_TRUE(GeolocReadTimeZone(doc, &tz));
+  TEST_ASSERT_EQUAL(sizeof(tz.name) - 1, strlen(tz.name));
+  TEST_ASSERT_EQUAL_STRING("", tz.current_time);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_winter);
+  RUN_TEST(test_summer);
+  RUN_TEST(test_fractional_offset);
+  RUN_TEST(test_filter_drops_the_rest);
+  RUN_TEST(test_error_reply);
+  RUN_TEST(test_no_time_zone);
+  RUN_TEST(test_truncated_reply);
+  RUN_TEST(test_long_name_truncated);
+  return UNITY_END();
+}
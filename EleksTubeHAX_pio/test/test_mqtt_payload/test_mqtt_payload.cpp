@@ -0,0 +1,166 @@
+// Host tests for the MQTT payload parsing. Run with: pio test -e native
+#include <unity.h>
+#include <string.h>
+#include <stdlib.h>
+#include "MqttPayload.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static bool parse(const char *text, int *value) {
+  return MqttParseInt((const uint8_t *)text, strlen(text), value);
+}
+
+static const int untouched = 12345;
+
+void test_plain_numbers(void) {
+  int v;
+  TEST_ASSERT_TRUE(parse("0", &v));   TEST_ASSERT_EQUAL(0, v);
+  TEST_ASSERT_TRUE(parse("42", &v));  TEST_ASSERT_EQUAL(42, v);
+  TEST_ASSERT_TRUE(parse("007", &v)); TEST_ASSERT_EQUAL(7, v);
+}
+
+void test_sign(void) {
+  int v;
+  TEST_ASSERT_TRUE(parse("-7", &v));  TEST_ASSERT_EQUAL(-7, v);
+  TEST_ASSERT_TRUE(parse("+5", &v));  TEST_ASSERT_EQUAL(5, v);
+  TEST_ASSERT_TRUE(parse("-0", &v));  TEST_ASSERT_EQUAL(0, v);
+  v = untouched;
+  TEST_ASSERT_FALSE(parse("-", &v));
+  TEST_ASSERT_FALSE(parse("+", &v));
+  TEST_ASSERT_FALSE(parse("--1", &v));
+  TEST_ASSERT_FALSE(parse("+-1", &v));
+  TEST_ASSERT_EQUAL(untouched, v);
+}
+
+void test_range(void) {
+  int v;
+  TEST_ASSERT_TRUE(parse("999999999", &v));   TEST_ASSERT_EQUAL(999999999, v);
+  TEST_ASSERT_TRUE(parse("-999999999", &v));  TEST_ASSERT_EQUAL(-999999999, v);
+  v = untouched;
+  TEST_ASSERT_FALSE(parse("1000000000", &v));  // 10 digits could overflow an int
+  TEST_ASSERT_FALSE(parse("-2147483648", &v));
+  TEST_ASSERT_FALSE(parse("99999999999999999999", &v));
+  TEST_ASSERT_EQUAL(untouched, v);
+}
+
+void test_fraction_is_truncated(void) {
+  int v;
+  TEST_ASSERT_TRUE(parse("12.9", &v));  TEST_ASSERT_EQUAL(12, v);
+  TEST_ASSERT_TRUE(parse("-3.7", &v));  TEST_ASSERT_EQUAL(-3, v);
+  TEST_ASSERT_TRUE(parse("25.", &v));   TEST_ASSERT_EQUAL(25, v);
+  v = untouched;
+  TEST_ASSERT_FALSE(parse(".5", &v));   // no integer digits
+  TEST_ASSERT_FALSE(parse("1.2.3", &v));
+  TEST_ASSERT_EQUAL(untouched, v);
+}
+
+void test_trailing_garbage(void) {
+  int v = untouched;
+  TEST_ASSERT_FALSE(parse("12a", &v));
+  TEST_ASSERT_FALSE(parse("12 ", &v));
+  TEST_ASSERT_FALSE(parse(" 12", &v));
+  TEST_ASSERT_FALSE(parse("1-2", &v));
+  TEST_ASSERT_FALSE(parse("1.5x", &v));
+  TEST_ASSERT_FALSE(parse("ON", &v));
+  TEST_ASSERT_EQUAL(untouched, v);
+}
+
+void test_empty_payload(void) {
+  int v = untouched;
+  TEST_ASSERT_FALSE(parse("", &v));
+  TEST_ASSERT_FALSE(MqttParseInt(NULL, 0, &v));
+  TEST_ASSERT_EQUAL(untouched, v);
+}
+
+// Payloads aren't 0 terminated: only length bytes count.
+void test_length_is_respected(void) {
+  int v;
+  const uint8_t payload[] = { '1', '2', '3', 'x' };
+  TEST_ASSERT_TRUE(MqttParseInt(payload, 3, &v));  TEST_ASSERT_EQUAL(123, v);
+  TEST_ASSERT_TRUE(MqttParseInt(payload, 2, &v));  TEST_ASSERT_EQUAL(12, v);
+  TEST_ASSERT_FALSE(MqttParseInt(payload, 4, &v));
+}
+
+void test_payload_is(void) {
+  const uint8_t on[] = { 'O', 'N' };
+  TEST_ASSERT_TRUE(MqttPayloadIs(on, 2, "ON"));
+  TEST_ASSERT_FALSE(MqttPayloadIs(on, 1, "ON"));
+  TEST_ASSERT_FALSE(MqttPayloadIs(on, 2, "ONE"));
+  TEST_ASSERT_FALSE(MqttPayloadIs(on, 2, "on"));
+  TEST_ASSERT_TRUE(MqttPayloadIs(on, 0, ""));
+}
+
+// Long payloads: the digit limit and the fraction loop must not depend on the length.
+void test_long_payloads(void) {
+  static uint8_t payload[20000];
+  int v = untouched;
+  memset(payload, '1', sizeof(payload));
+  TEST_ASSERT_FALSE(MqttParseInt(payload, sizeof(payload), &v));
+  payload[1] = '.';
+  TEST_ASSERT_TRUE(MqttParseInt(payload, sizeof(payload), &v));
+  TEST_ASSERT_EQUAL(1, v);
+  payload[sizeof(payload) - 1] = 'x';
+  v = untouched;
+  TEST_ASSERT_FALSE(MqttParseInt(payload, sizeof(payload), &v));
+  TEST_ASSERT_EQUAL(untouched, v);
+  TEST_ASSERT_FALSE(MqttPayloadIs(payload, sizeof(payload), "1.1"));
+}
+
+// What MqttParseInt should do, written the slow and obvious way.
+static bool referenceParse(const uint8_t *p, unsigned int length, int *value) {
+  char text[40];
+  if (length >= sizeof(text)) return false;  // the random payloads are shorter
+  memcpy(text, p, length);
+  text[length] = '\0';
+  const char *s = text;
+  if (*s == '-' || *s == '+') s++;
+  size_t digits = strspn(s, "0123456789");
+  if (digits == 0 || digits > 9) return false;
+  const char *rest = s + digits;
+  if (*rest == '.') rest += 1 + strspn(rest + 1, "0123456789");
+  if (*rest != '\0') return false;
+  *value = atoi(text);  // stops at the '.'
+  return true;
+}
+
+// Random payloads from the characters that matter, compared with referenceParse(). The bytes after
+// the payload are digits: reading past length would change the result.
+void test_random_payloads(void) {
+  static const char alphabet[] = "0123456789-+.x 9";
+  uint32_t seed = 12345;
+  uint8_t buffer[32 + 8];
+  int accepted = 0;
+  for (int n = 0; n < 200000; n++) {
+    seed = seed * 1103515245 + 12345;
+    unsigned int length = (seed >> 16) % 16;
+    for (unsigned int i = 0; i < length; i++) {
+      seed = seed * 1103515245 + 12345;
+      buffer[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+    }
+    memset(buffer + length, '7', 8);
+    int v = untouched, expected = untouched;
+    bool ok = MqttParseInt(buffer, length, &v);
+    TEST_ASSERT_EQUAL(referenceParse(buffer, length, &expected), ok);
+    TEST_ASSERT_EQUAL(expected, v);
+    TEST_ASSERT_TRUE((v >= -999999999) && (v <= 999999999));
+    if (ok) accepted++;
+    TEST_ASSERT_EQUAL((length == 2) && (memcmp(buffer, "+1", 2) == 0), MqttPayloadIs(buffer, length, "+1"));
+  }
+  TEST_ASSERT_TRUE(accepted > 1000);  // the alphabet gives enough valid numbers to compare
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_plain_numbers);
+  RUN_TEST(test_sign);
+  RUN_TEST(test_range);
+  RUN_TEST(test_fraction_is_truncated);
+  RUN_TEST(test_trailing_garbage);
+  RUN_TEST(test_empty_payload);
+  RUN_TEST(test_length_is_respected);
+  RUN_TEST(test_payload_is);
+  RUN_TEST(test_long_payloads);
+  RUN_TEST(test_random_payloads);
+  return UNITY_END();
+}
@@ -0,0 +1,176 @@
+// Host tests for the MQTT publish queue. Run with: pio test -e native
+#include <unity.h>
+#include <string.h>
+#include "MqttQueue.h"
+
+// Small, so it is quick to fill: 3 messages of up to 7 characters.
+typedef MqttQueue<3, 16, 8, 32> Queue;
+
+static char sent[8][48];
+static int sent_count;
+
+static void record(const char *topic, const char *message) {
+  if (sent_count < 8) snprintf(sent[sent_count], sizeof(sent[0]), "%s=%s", topic, message);
+  sent_count++;
+}
+
+// Publishes everything, 120 ms apart.
+static void drain(Queue *q) {
+  uint32_t now = 1000;
+  while (q->publishNext(now, 120, record)) now += 120;
+}
+
+void setUp(void) { sent_count = 0; }
+void tearDown(void) {}
+
+void test_fifo_order(void) {
+  Queue q;
+  bool truncated;
+  TEST_ASSERT_EQUAL(Queue::queued, q.push("a", "1", &truncated));
+  TEST_ASSERT_FALSE(truncated);
+  q.push("b", "2", &truncated);
+  q.push("c", "3", &truncated);
+  TEST_ASSERT_EQUAL(3, q.waiting());
+  drain(&q);
+  TEST_ASSERT_EQUAL(3, sent_count);
+  TEST_ASSERT_EQUAL_STRING("a=1", sent[0]);
+  TEST_ASSERT_EQUAL_STRING("b=2", sent[1]);
+  TEST_ASSERT_EQUAL_STRING("c=3", sent[2]);
+  TEST_ASSERT_TRUE(q.isEmpty());
+}
+
+// A newer value for a waiting topic replaces the old one, in the old one's place.
+void test_same_topic_coalesced(void) {
+  Queue q;
+  bool truncated;
+  q.push("a", "1", &truncated);
+  q.push("b", "2", &truncated);
+  TEST_ASSERT_EQUAL(Queue::replaced, q.push("a", "9", &truncated));
+  TEST_ASSERT_EQUAL(2, q.waiting());
+  drain(&q);
+  TEST_ASSERT_EQUAL(2, sent_count);
+  TEST_ASSERT_EQUAL_STRING("a=9", sent[0]);
+  TEST_ASSERT_EQUAL_STRING("b=2", sent[1]);
+}
+
+// Once published, the same topic is queued again, at the end.
+void test_same_topic_after_publish(void) {
+  Queue q;
+  bool truncated;
+  q.push("a", "1", &truncated);
+  q.push("b", "2", &truncated);
+  TEST_ASSERT_TRUE(q.publishNext(500, 120, record));
+  TEST_ASSERT_EQUAL(Queue::queued, q.push("a", "3", &truncated));
+  drain(&q);
+  TEST_ASSERT_EQUAL(3, sent_count);
+  TEST_ASSERT_EQUAL_STRING("b=2", sent[1]);
+  TEST_ASSERT_EQUAL_STRING("a=3", sent[2]);
+}
+
+void test_overflow_drops_oldest(void) {
+  Queue q;
+  bool truncated;
+  q.push("a", "1", &truncated);
+  q.push("b", "2", &truncated);
+  q.push("c", "3", &truncated);
+  TEST_ASSERT_EQUAL(Queue::dropped_oldest, q.push("d", "4", &truncated));
+  TEST_ASSERT_EQUAL_STRING("a", q.droppedTopic());
+  TEST_ASSERT_EQUAL(Queue::dropped_oldest, q.push("e", "5", &truncated));
+  TEST_ASSERT_EQUAL_STRING("b", q.droppedTopic());
+  TEST_ASSERT_EQUAL(3, q.waiting());
+  drain(&q);
+  TEST_ASSERT_EQUAL(3, sent_count);
+  TEST_ASSERT_EQUAL_STRING("c=3", sent[0]);
+  TEST_ASSERT_EQUAL_STRING("d=4", sent[1]);
+  TEST_ASSERT_EQUAL_STRING("e=5", sent[2]);
+}
+
+// A full queue still takes a new value for a waiting topic without dropping anything.
+void test_full_queue_coalesces(void) {
+  Queue q;
+  bool truncated;
+  q.push("a", "1", &truncated);
+  q.push("b", "2", &truncated);
+  q.push("c", "3", &truncated);
+  TEST_ASSERT_EQUAL(Queue::replaced, q.push("b", "8", &truncated));
+  drain(&q);
+  TEST_ASSERT_EQUAL(3, sent_count);
+  TEST_ASSERT_EQUAL_STRING("b=8", sent[1]);
+}
+
+void test_truncation(void) {
+  Queue q;
+  bool truncated;
+  q.push("a", "1234567", &truncated);  // exactly fits, with its terminator
+  TEST_ASSERT_FALSE(truncated);
+  q.push("b", "12345678", &truncated);
+  TEST_ASSERT_TRUE(truncated);
+  q.push("a-very-long-topic-name", "x", &truncated);  // topic cut to 15 characters
+  drain(&q);
+  TEST_ASSERT_EQUAL_STRING("a=1234567", sent[0]);
+  TEST_ASSERT_EQUAL_STRING("b=1234567", sent[1]);
+  TEST_ASSERT_EQUAL_STRING("a-very-long-top=x", sent[2]);
+}
+
+void test_rate_limit(void) {
+  Queue q;
+  bool truncated;
+  q.push("a", "1", &truncated);
+  q.push("b", "2", &truncated);
+  TEST_ASSERT_TRUE(q.publishNext(5000, 120, record));
+  TEST_ASSERT_FALSE(q.publishNext(5000, 120, record));
+  TEST_ASSERT_FALSE(q.publishNext(5119, 120, record));
+  TEST_ASSERT_TRUE(q.publishNext(5120, 120, record));
+  TEST_ASSERT_FALSE(q.publishNext(9000, 120, record));  // empty
+  TEST_ASSERT_EQUAL(2, sent_count);
+}
+
+// The long message waits until the queue is empty, and a newer one replaces it.
+void test_large_message_last(void) {
+  Queue q;
+  bool truncated;
+  snprintf(q.largeMessage(), q.largeSize(), "%s", "{\"old\":1}");
+  q.pushLarge("report/metrics");
+  snprintf(q.largeMessage(), q.largeSize(), "%s", "{\"new\":2}");
+  q.pushLarge("report/metrics");
+  q.push("a", "1", &truncated);
+  TEST_ASSERT_FALSE(q.isEmpty());
+  drain(&q);
+  TEST_ASSERT_EQUAL(2, sent_count);
+  TEST_ASSERT_EQUAL_STRING("a=1", sent[0]);
+  TEST_ASSERT_EQUAL_STRING("report/metrics={\"new\":2}", sent[1]);
+  TEST_ASSERT_TRUE(q.isEmpty());
+}
+
+// Many pushes and publishes wrap the ring around; the order must survive it.
+void test_wraparound(void) {
+  Queue q;
+  bool truncated;
+  char topic[4], message[4];
+  for (int i = 0; i < 50; i++) {
+    snprintf(topic, sizeof(topic), "t%d", i % 7);
+    snprintf(message, sizeof(message), "%d", i);
+    q.push(topic, message, &truncated);
+    sent_count = 0;
+    TEST_ASSERT_TRUE(q.publishNext(1000 + i * 1000, 120, record));
+    TEST_ASSERT_EQUAL(1, sent_count);
+    char expected[16];
+    snprintf(expected, sizeof(expected), "%s=%s", topic, message);
+    TEST_ASSERT_EQUAL_STRING(expected, sent[0]);
+  }
+  TEST_ASSERT_TRUE(q.isEmpty());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fifo_order);
+  RUN_TEST(test_same_topic_coalesced);
+  RUN_TEST(test_same_topic_after_publish);
+  RUN_TEST(test_overflow_drops_oldest);
+  RUN_TEST(test_full_queue_coalesces);
+  RUN_TEST(test_truncation);
+  RUN_TEST(test_rate_limit);
+  RUN_TEST(test_large_message_last);
+  RUN_TEST(test_wraparound);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+// Host tests for the MQTT reconnect backoff and connection state. Run with: pio test -e native
+#include <unity.h>
+#include "MqttReconnect.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const uint32_t min_ms = 5000, max_ms = 300000;
+
+void test_backoff_doubles(void) {
+  TEST_ASSERT_EQUAL_UINT32(5000, MqttReconnectBackoff(1, 0, min_ms, max_ms));
+  TEST_ASSERT_EQUAL_UINT32(10000, MqttReconnectBackoff(2, 0, min_ms, max_ms));
+  TEST_ASSERT_EQUAL_UINT32(20000, MqttReconnectBackoff(3, 0, min_ms, max_ms));
+  TEST_ASSERT_EQUAL_UINT32(160000, MqttReconnectBackoff(6, 0, min_ms, max_ms));
+  TEST_ASSERT_EQUAL_UINT32(300000, MqttReconnectBackoff(7, 0, min_ms, max_ms));  // 320 s capped
+}
+
+// However many failures and whatever the random number: between the step and 25% above it, never above
+// max_ms + 25%.
+void test_backoff_bounds(void) {
+  uint32_t random = 1;
+  for (uint32_t failures = 1; failures < 100000; failures += (failures < 40) ? 1 : 997) {
+    uint32_t step = min_ms;
+    for (uint32_t i = 1; (i < failures) && (step < max_ms); i++) step *= 2;
+    if (step > max_ms) step = max_ms;
+    for (int n = 0; n < 50; n++) {
+      random = random * 1103515245 + 12345;
+      uint32_t backoff = MqttReconnectBackoff(failures, random, min_ms, max_ms);
+      TEST_ASSERT_TRUE(backoff >= step);
+      TEST_ASSERT_TRUE(backoff <= step + step / 4);
+      TEST_ASSERT_TRUE(backoff <= max_ms + max_ms / 4);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(5000 + 1250, MqttReconnectBackoff(1, 1250, min_ms, max_ms));
+  TEST_ASSERT_EQUAL_UINT32(5000, MqttReconnectBackoff(1, 1251, min_ms, max_ms));
+  TEST_ASSERT_EQUAL_UINT32(375000, MqttReconnectBackoff(0xFFFFFFFF, 75000, min_ms, max_ms));
+}
+
+void test_first_attempt_at_once(void) {
+  MqttReconnect r(min_ms, max_ms);
+  TEST_ASSERT_EQUAL(mqtt_disconnected, r.state);
+  TEST_ASSERT_TRUE(r.startAttempt(0));
+  TEST_ASSERT_EQUAL(mqtt_connecting, r.state);
+  TEST_ASSERT_EQUAL_UINT32(1, r.attempts);
+  TEST_ASSERT_FALSE(r.startAttempt(0));  // already connecting
+  r.succeeded(100);
+  TEST_ASSERT_EQUAL(mqtt_connected, r.state);
+  TEST_ASSERT_TRUE(r.isConnected());
+  TEST_ASSERT_FALSE(r.startAttempt(100000));  // connected: nothing to do
+}
+
+void test_failures_back_off(void) {
+  MqttReconnect r(min_ms, max_ms);
+  uint32_t now = 1000;
+  TEST_ASSERT_TRUE(r.startAttempt(now));
+  r.failed(now, 0);
+  TEST_ASSERT_EQUAL(mqtt_disconnected, r.state);
+  TEST_ASSERT_EQUAL_UINT32(1, r.failures);
+  TEST_ASSERT_EQUAL_UINT32(5000, r.backoff_ms);
+  TEST_ASSERT_FALSE(r.startAttempt(now + 4999));
+  TEST_ASSERT_TRUE(r.startAttempt(now + 5000));
+  now += 5000;
+  r.failed(now, 0);
+  TEST_ASSERT_EQUAL_UINT32(10000, r.backoff_ms);
+  TEST_ASSERT_FALSE(r.startAttempt(now + 9999));
+  TEST_ASSERT_TRUE(r.startAttempt(now + 10000));
+  TEST_ASSERT_EQUAL_UINT32(3, r.attempts);
+}
+
+// One success and the next failure starts from the minimum again.
+void test_reset_on_success(void) {
+  MqttReconnect r(min_ms, max_ms);
+  uint32_t now = 0;
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_TRUE(r.startAttempt(now));
+    r.failed(now, 0);
+    now += r.backoff_ms;
+  }
+  TEST_ASSERT_EQUAL_UINT32(300000, r.backoff_ms);
+  TEST_ASSERT_TRUE(r.startAttempt(now));
+  r.succeeded(now);
+  TEST_ASSERT_EQUAL_UINT32(0, r.failures);
+  TEST_ASSERT_EQUAL_UINT32(5000, r.backoff_ms);
+  r.lost();
+  TEST_ASSERT_TRUE(r.startAttempt(now + 5000));
+  r.failed(now + 5000, 0);
+  TEST_ASSERT_EQUAL_UINT32(5000, r.backoff_ms);
+}
+
+void test_lost(void) {
+  MqttReconnect r(min_ms, max_ms);
+  r.lost();  // not connected: stays disconnected
+  TEST_ASSERT_EQUAL(mqtt_disconnected, r.state);
+  TEST_ASSERT_TRUE(r.startAttempt(0));
+  r.lost();  // a connect in progress isn't lost, the connect task finishes it
+  TEST_ASSERT_EQUAL(mqtt_connecting, r.state);
+  r.succeeded(0);
+  r.lost();
+  TEST_ASSERT_EQUAL(mqtt_disconnected, r.state);
+  TEST_ASSERT_FALSE(r.startAttempt(4999));
+  TEST_ASSERT_TRUE(r.startAttempt(5000));
+}
+
+// millis() wraps after 49 days; the backoff must still expire.
+void test_millis_wrap(void) {
+  MqttReconnect r(min_ms, max_ms);
+  uint32_t now = 0xFFFFFFFF - 1000;
+  TEST_ASSERT_TRUE(r.startAttempt(now));
+  r.failed(now, 0);
+  TEST_ASSERT_FALSE(r.startAttempt(now + 4999));
+  TEST_ASSERT_TRUE(r.startAttempt(now + 5000));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_backoff_doubles);
+  RUN_TEST(test_backoff_bounds);
+  RUN_TEST(test_first_attempt_at_once);
+  RUN_TEST(test_failures_back_off);
+  RUN_TEST(test_reset_on_success);
+  RUN_TEST(test_lost);
+  RUN_TEST(test_millis_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,93 @@
+// Host tests for the RTC cache, against a simulated RTC that counts its bus transactions.
+// Run with: pio test -e native
+#include <unity.h>
+#include "RtcCache.h"
+
+// Simulated clock: the RTC, millis() and the square wave all follow sim_ms.
+static const uint32_t start_time = 1700000000;
+static uint32_t sim_ms, rtc_offset, reads, writes;
+
+static uint32_t rtcRead()        { reads++; return start_time + sim_ms / 1000 + rtc_offset; }
+static void rtcWrite(uint32_t t) { writes++; rtc_offset = t - (start_time + sim_ms / 1000); }
+static uint32_t sqwTicks()       { return sim_ms / 1000; }
+
+void setUp(void) { sim_ms = 0; rtc_offset = 0; reads = 0; writes = 0; }
+void tearDown(void) {}
+
+// TimeLib calls the sync provider on every now() once the sync interval is short; here 10 times a second for a day.
+static void runDay(RtcCache &cache) {
+  for (sim_ms = 0; sim_ms < 86400UL * 1000; sim_ms += 100) {
+    TEST_ASSERT_EQUAL_UINT32(start_time + sim_ms / 1000, cache.get(sim_ms, sqwTicks()));
+  }
+}
+
+void test_millis_extrapolation(void) {
+  RtcCache cache(rtcRead, rtcWrite, false, 3600);
+  runDay(cache);
+  TEST_ASSERT_EQUAL(24, reads);  // once an hour instead of 864000 times
+}
+
+void test_sqw_extrapolation(void) {
+  RtcCache cache(rtcRead, rtcWrite, true, 86400);
+  runDay(cache);
+  TEST_ASSERT_EQUAL(1, reads);
+}
+
+// Without the square wave, the reading is only as good as millis(); the re-read corrects a drift.
+void test_millis_drift_corrected(void) {
+  RtcCache cache(rtcRead, rtcWrite, false, 3600);
+  cache.get(0, 0);
+  rtc_offset = 5;  // RTC is 5 s ahead of what millis() says
+  sim_ms = 10000;
+  TEST_ASSERT_EQUAL_UINT32(start_time + 10, cache.get(sim_ms, 0));
+  sim_ms = 3600000;
+  TEST_ASSERT_EQUAL_UINT32(start_time + 3600 + 5, cache.get(sim_ms, 0));
+  TEST_ASSERT_EQUAL(2, reads);
+}
+
+void test_sqw_follows_ticks(void) {
+  RtcCache cache(rtcRead, rtcWrite, true, 86400);
+  cache.get(0, 100);
+  // The ticks count, not millis(): 3 edges in what millis() thinks is 1 s.
+  TEST_ASSERT_EQUAL_UINT32(start_time + 3, cache.get(1000, 103));
+  TEST_ASSERT_EQUAL(1, reads);
+}
+
+void test_get_fresh_always_reads(void) {
+  RtcCache cache(rtcRead, rtcWrite, false, 3600);
+  cache.get(0, 0);
+  rtc_offset = 2;
+  TEST_ASSERT_EQUAL_UINT32(start_time + 2, cache.getFresh(0, 0));
+  TEST_ASSERT_EQUAL_UINT32(start_time + 2, cache.get(500, 0));  // cache restarted from the fresh reading
+  TEST_ASSERT_EQUAL(2, reads);
+}
+
+void test_set_writes_once_and_restarts(void) {
+  RtcCache cache(rtcRead, rtcWrite, true, 86400);
+  cache.get(0, 0);
+  sim_ms = 2500;
+  cache.set(start_time + 100, sim_ms, 2);
+  TEST_ASSERT_EQUAL(1, writes);
+  TEST_ASSERT_EQUAL_UINT32(start_time + 101, cache.get(3500, 3));
+  TEST_ASSERT_EQUAL(1, reads);  // no read back after the write
+}
+
+void test_invalidate(void) {
+  RtcCache cache(rtcRead, rtcWrite, false, 3600);
+  cache.get(0, 0);
+  cache.invalidate();
+  cache.get(1, 0);
+  TEST_ASSERT_EQUAL(2, reads);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_millis_extrapolation);
+  RUN_TEST(test_sqw_extrapolation);
+  RUN_TEST(test_millis_drift_corrected);
+  RUN_TEST(test_sqw_follows_ticks);
+  RUN_TEST(test_get_fresh_always_reads);
+  RUN_TEST(test_set_writes_once_and_restarts);
+  RUN_TEST(test_invalidate);
+  return UNITY_END();
+}
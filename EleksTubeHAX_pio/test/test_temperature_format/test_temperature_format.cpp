@@ -0,0 +1,74 @@
+// Host tests for the temperature conversion and formatting. Run with: pio test -e native
+#include <unity.h>
+#include <math.h>
+#include "TemperatureFormat.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const char *format(int32_t raw, bool fahrenheit) {
+  static char buf[10];
+  FormatTemperature(buf, sizeof(buf), raw, fahrenheit);
+  return buf;
+}
+
+void test_celsius(void) {
+  TEST_ASSERT_EQUAL_STRING("0.00", format(0, false));
+  TEST_ASSERT_EQUAL_STRING("21.50", format(21 * 128 + 64, false));
+  TEST_ASSERT_EQUAL_STRING("125.00", format(125 * 128, false));  // DS18B20 maximum
+  TEST_ASSERT_EQUAL_STRING("0.01", format(1, false));            // 0.0078 C
+}
+
+void test_negative(void) {
+  TEST_ASSERT_EQUAL_STRING("-0.01", format(-1, false));  // the sign of a value below 1 isn't lost
+  TEST_ASSERT_EQUAL_STRING("-0.50", format(-64, false));
+  TEST_ASSERT_EQUAL_STRING("-10.06", format(-10 * 128 - 8, false));  // -10.0625
+  TEST_ASSERT_EQUAL_STRING("-54.99", format(-7039, false));  // next to the sentinel, still a reading
+}
+
+// Every raw value, against floating point. Halves are rounded away from zero (in F, of the part above 32 F).
+void test_rounding(void) {
+  for (int32_t raw = -7039; raw <= 125 * 128; raw++) {
+    TEST_ASSERT_EQUAL((int32_t)lround(raw * 100 / 128.0), TemperatureCenti(raw));
+    TEST_ASSERT_EQUAL((int32_t)lround(raw * 100 / 128.0 * 9 / 5) + 3200, TemperatureCentiF(raw));
+  }
+}
+
+void test_fahrenheit(void) {
+  TEST_ASSERT_EQUAL_STRING("32.00", format(0, true));
+  TEST_ASSERT_EQUAL_STRING("212.00", format(100 * 128, true));
+  TEST_ASSERT_EQUAL_STRING("257.00", format(125 * 128, true));
+  TEST_ASSERT_EQUAL_STRING("-40.00", format(-40 * 128, true));   // where the scales meet
+  TEST_ASSERT_EQUAL_STRING("-0.40", format(-18 * 128, true));   // below 0 F
+  TEST_ASSERT_EQUAL_STRING("31.99", format(-1, true));            // 31.986 F
+  TEST_ASSERT_EQUAL_STRING("32.01", format(1, true));             // 32.014 F
+  TEST_ASSERT_EQUAL_STRING("70.70", format(21 * 128 + 64, true)); // 21.5 C
+}
+
+// Not a reading: empty, whatever the unit, instead of "-55.00" (or "-67.00").
+void test_disconnected(void) {
+  char buf[10] = "x";
+  TEST_ASSERT_FALSE(FormatTemperature(buf, sizeof(buf), TEMPERATURE_DISCONNECTED_RAW, false));
+  TEST_ASSERT_EQUAL_STRING("", buf);
+  buf[0] = 'x';
+  TEST_ASSERT_FALSE(FormatTemperature(buf, sizeof(buf), TEMPERATURE_DISCONNECTED_RAW, true));
+  TEST_ASSERT_EQUAL_STRING("", buf);
+  TEST_ASSERT_TRUE(FormatTemperature(buf, sizeof(buf), 0, false));
+}
+
+void test_small_buffer(void) {
+  char buf[4];
+  FormatTemperature(buf, sizeof(buf), -10 * 128, false);
+  TEST_ASSERT_EQUAL_STRING("-10", buf);  // cut, but terminated
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_celsius);
+  RUN_TEST(test_negative);
+  RUN_TEST(test_rounding);
+  RUN_TEST(test_fahrenheit);
+  RUN_TEST(test_disconnected);
+  RUN_TEST(test_small_buffer);
+  return UNITY_END();
+}
@@ -0,0 +1,155 @@
+// Host tests for the sensor history. Run with: pio test -e native
+#include <unity.h>
+#include <string.h>
+#include "TimeSeries.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const time_t hour0 = 1699999200;  // a whole hour
+static const time_t minute = 60, hour = 3600;
+
+void test_empty(void) {
+  TimeSeries ts;
+  TimeSeries::Stats s;
+  TEST_ASSERT_TRUE(ts.isValid());
+  TEST_ASSERT_FALSE(ts.getStats(hour0, 60, &s));
+  TEST_ASSERT_FALSE(ts.getStats(hour0, 86400, &s));
+  TEST_ASSERT_EQUAL(0, s.count);
+}
+
+void test_minute_stats(void) {
+  TimeSeries ts;
+  TimeSeries::Stats s;
+  ts.add(hour0 + 5, 10);
+  ts.add(hour0 + 20, 30);
+  ts.add(hour0 + 50, 20);
+  TEST_ASSERT_TRUE(ts.getStats(hour0 + 59, 60, &s));
+  TEST_ASSERT_EQUAL(10, s.min);
+  TEST_ASSERT_EQUAL(30, s.max);
+  TEST_ASSERT_EQUAL(20, s.avg);
+  TEST_ASSERT_EQUAL(3, s.count);
+}
+
+void test_minute_rollover(void) {
+  TimeSeries ts;
+  TimeSeries::Stats s;
+  ts.add(hour0, 100);
+  ts.add(hour0 + minute, 200);
+  // The last minute only has the new bucket, the last two have both.
+  TEST_ASSERT_TRUE(ts.getStats(hour0 + minute, 60, &s));
+  TEST_ASSERT_EQUAL(1, s.count);
+  TEST_ASSERT_EQUAL(200, s.min);
+  TEST_ASSERT_TRUE(ts.getStats(hour0 + minute, 120, &s));
+  TEST_ASSERT_EQUAL(2, s.count);
+  TEST_ASSERT_EQUAL(100, s.min);
+  TEST_ASSERT_EQUAL(150, s.avg);
+}
+
+// An hour later the same minute slot is reused: the old reading must not leak into the new bucket.
+void test_minute_slot_reused(void) {
+  TimeSeries ts;
+  TimeSeries::Stats s;
+  ts.add(hour0, -500);
+  ts.add(hour0 + hour, 7);
+  TEST_ASSERT_TRUE(ts.getStats(hour0 + hour, 60, &s));
+  TEST_ASSERT_EQUAL(1, s.count);
+  TEST_ASSERT_EQUAL(7, s.min);
+  TEST_ASSERT_EQUAL(7, s.max);
+}
+
+void test_windows(void) {
+  TimeSeries ts;
+  TimeSeries::Stats s;
+  // One reading per minute over two hours: value = minutes since hour0.
+  for (int m = 0; m < 120; m++) ts.add(hour0 + m * minute, m);
+  time_t t = hour0 + 119 * minute;
+  TEST_ASSERT_TRUE(ts.getStats(t, 15 * 60, &s));
+  TEST_ASSERT_EQUAL(105, s.min);
+  TEST_ASSERT_EQUAL(119, s.max);
+  TEST_ASSERT_EQUAL(15, s.count);
+  TEST_ASSERT_TRUE(ts.getStats(t, 3600, &s));
+  TEST_ASSERT_EQUAL(60, s.min);
+  TEST_ASSERT_EQUAL(60, s.count);
+  // Above an hour the hour buckets are used: both hours, all readings.
+  TEST_ASSERT_TRUE(ts.getStats(t, 86400, &s));
+  TEST_ASSERT_EQUAL(0, s.min);
+  TEST_ASSERT_EQUAL(119, s.max);
+  TEST_ASSERT_EQUAL(120, s.count);
+  TEST_ASSERT_EQUAL(60, s.avg);  // 59.5 rounded
+  TEST_ASSERT_TRUE(ts.getStats(t, 2 * 3600, &s));
+  TEST_ASSERT_EQUAL(120, s.count);
+}
+
+// After a gap (a reboot, a dead sensor) old buckets are skipped, not shown as recent.
+void test_gap(void) {
+  TimeSeries ts;
+  TimeSeries::Stats s;
+  ts.add(hour0, 1);
+  time_t later = hour0 + 3 * hour + 30 * minute;
+  TEST_ASSERT_FALSE(ts.getStats(later, 3600, &s));
+  TEST_ASSERT_FALSE(ts.getStats(later, 3 * 3600, &s));
+  TEST_ASSERT_TRUE(ts.getStats(later, 4 * 3600, &s));
+  TEST_ASSERT_EQUAL(1, s.count);
+  TEST_ASSERT_FALSE(ts.getStats(hour0 + 25 * hour, 86400, &s));  // the day after: gone
+}
+
+void test_new_hour(void) {
+  TimeSeries ts;
+  TEST_ASSERT_TRUE(ts.add(hour0 + 10, 1));
+  TEST_ASSERT_FALSE(ts.add(hour0 + 59 * minute, 1));
+  TEST_ASSERT_TRUE(ts.add(hour0 + hour, 1));
+  TEST_ASSERT_TRUE(ts.add(hour0 + hour + 24 * hour, 1));  // same slot, next day
+}
+
+void test_negative_average_rounding(void) {
+  TimeSeries ts;
+  TimeSeries::Stats s;
+  ts.add(hour0, -10);
+  ts.add(hour0 + 1, -11);
+  TEST_ASSERT_TRUE(ts.getStats(hour0 + 1, 60, &s));
+  TEST_ASSERT_EQUAL(-11, s.avg);  // -10.5 rounded away from 0
+}
+
+void test_report(void) {
+  TimeSeries ts(100);
+  ts.add(hour0, 2301);
+  ts.add(hour0 + 30, 2311);
+  char buf[128];
+  ts.report(buf, sizeof(buf), hour0 + 30);
+  TEST_ASSERT_EQUAL_STRING("{\"scale\":100,\"1m\":[2301,2311,2306],\"15m\":[2301,2311,2306],"
+                           "\"1h\":[2301,2311,2306],\"24h\":[2301,2311,2306]}", buf);
+  ts.report(buf, sizeof(buf), hour0 + 2 * hour);
+  TEST_ASSERT_EQUAL_STRING("{\"scale\":100,\"1m\":null,\"15m\":null,\"1h\":null,\"24h\":[2301,2311,2306]}", buf);
+}
+
+// What StoredConfig does: save data(), load it into another series.
+void test_persist(void) {
+  TimeSeries a, b;
+  TimeSeries::Stats s;
+  a.add(hour0, 42);
+  uint8_t blob[2048];
+  TEST_ASSERT_TRUE(a.dataSize() <= sizeof(blob));
+  memcpy(blob, a.data(), a.dataSize());
+  memcpy(b.data(), blob, b.dataSize());
+  TEST_ASSERT_TRUE(b.isValid());
+  TEST_ASSERT_TRUE(b.getStats(hour0, 60, &s));
+  TEST_ASSERT_EQUAL(42, s.max);
+  memset(b.data(), 0xFF, b.dataSize());  // garbage
+  TEST_ASSERT_FALSE(b.isValid());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_minute_stats);
+  RUN_TEST(test_minute_rollover);
+  RUN_TEST(test_minute_slot_reused);
+  RUN_TEST(test_windows);
+  RUN_TEST(test_gap);
+  RUN_TEST(test_new_hour);
+  RUN_TEST(test_negative_average_rounding);
+  RUN_TEST(test_report);
+  RUN_TEST(test_persist);
+  return UNITY_END();
+}
@@ -0,0 +1,128 @@
+// Host tests for the POSIX TZ parser and the DST transitions. Run with: pio test -e native
+// Expected times are UTC, checked against the IANA zones the strings describe.
+#include <unity.h>
+#include "TimeZone.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static const time_t cet_dst_start_2024 = 1711846800;  // 2024-03-31 01:00 UTC
+static const time_t cet_dst_end_2024   = 1729990800;  // 2024-10-27 01:00 UTC
+
+void test_central_europe(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("CET-1CEST,M3.5.0,M10.5.0/3"));
+  TEST_ASSERT_EQUAL(3600, tz.getOffset(cet_dst_start_2024 - 1));
+  TEST_ASSERT_FALSE(tz.isDst(cet_dst_start_2024 - 1));
+  TEST_ASSERT_EQUAL(7200, tz.getOffset(cet_dst_start_2024));
+  TEST_ASSERT_TRUE(tz.isDst(cet_dst_start_2024));
+  TEST_ASSERT_EQUAL(7200, tz.getOffset(cet_dst_end_2024 - 1));
+  TEST_ASSERT_EQUAL(3600, tz.getOffset(cet_dst_end_2024));
+  TEST_ASSERT_EQUAL(cet_dst_end_2024, tz.getNextTransition(cet_dst_start_2024));
+}
+
+void test_us_eastern(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("EST5EDT,M3.2.0,M11.1.0"));
+  TEST_ASSERT_EQUAL(-18000, tz.getOffset(1710054000 - 1));  // 2024-03-10 07:00 UTC
+  TEST_ASSERT_EQUAL(-14400, tz.getOffset(1710054000));
+  TEST_ASSERT_EQUAL(-14400, tz.getOffset(1730613600 - 1));  // 2024-11-03 06:00 UTC
+  TEST_ASSERT_EQUAL(-18000, tz.getOffset(1730613600));
+}
+
+void test_dst_name_without_rules_uses_us_rules(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("EST5EDT"));
+  TEST_ASSERT_EQUAL(-18000, tz.getOffset(1710054000 - 1));
+  TEST_ASSERT_EQUAL(-14400, tz.getOffset(1710054000));
+}
+
+// DST over new year: starts in October, ends in April.
+void test_southern_hemisphere(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("AEST-10AEDT,M10.1.0,M4.1.0/3"));
+  TEST_ASSERT_EQUAL(39600, tz.getOffset(1704067200));         // 2024-01-01 00:00 UTC, summer
+  TEST_ASSERT_EQUAL(39600, tz.getOffset(1712419200 - 1));     // 2024-04-06 16:00 UTC
+  TEST_ASSERT_EQUAL(36000, tz.getOffset(1712419200));
+  TEST_ASSERT_FALSE(tz.isDst(1712419200));
+  TEST_ASSERT_EQUAL(36000, tz.getOffset(1728144000 - 1));     // 2024-10-05 16:00 UTC
+  TEST_ASSERT_EQUAL(39600, tz.getOffset(1728144000));
+  // Across new year's eve, the next transition is in the following year.
+  TEST_ASSERT_EQUAL(39600, tz.getOffset(1735689599));         // 2024-12-31 23:59:59 UTC
+  TEST_ASSERT_EQUAL(1743868800, tz.getNextTransition(1735689599));  // 2025-04-05 16:00 UTC
+}
+
+// Quoted names and a negative transition time (America/Nuuk since 2023).
+void test_negative_rule_time(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("<-02>2<-01>,M3.5.0/-1,M10.5.0/0"));
+  TEST_ASSERT_EQUAL(-7200, tz.getOffset(cet_dst_start_2024 - 1));
+  TEST_ASSERT_EQUAL(-3600, tz.getOffset(cet_dst_start_2024));
+}
+
+// Rule time beyond 24 h (Asia/Jerusalem): Thursday 26:00 is Friday 02:00.
+void test_rule_time_beyond_a_day(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("IST-2IDT,M3.4.4/26,M10.5.0"));
+  TEST_ASSERT_EQUAL(7200, tz.getOffset(1711670400 - 1));      // 2024-03-29 00:00 UTC
+  TEST_ASSERT_EQUAL(10800, tz.getOffset(1711670400));
+}
+
+// Jn never counts February 29th: J60 is March 1st, also in a leap year.
+void test_julian_without_leap_day(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("AAA0BBB,J60/0,J300/0"));
+  TEST_ASSERT_EQUAL(0, tz.getOffset(1709251200 - 1));         // 2024-03-01 00:00 UTC
+  TEST_ASSERT_EQUAL(3600, tz.getOffset(1709251200));
+  TEST_ASSERT_EQUAL(1729987200 - 3600, tz.getNextTransition(1709251200));  // 2024-10-27 00:00 local DST
+}
+
+// n counts from zero and includes February 29th.
+void test_julian_zero_based(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("AAA0BBB,59/0,300/0"));
+  TEST_ASSERT_EQUAL(0, tz.getOffset(1709164800 - 1));         // 2024-02-29 00:00 UTC
+  TEST_ASSERT_EQUAL(3600, tz.getOffset(1709164800));
+  TEST_ASSERT_EQUAL(0, tz.getOffset(1677628800 - 1));         // 2023-03-01 00:00 UTC
+  TEST_ASSERT_EQUAL(3600, tz.getOffset(1677628800));
+}
+
+void test_fixed_offset(void) {
+  TimeZone tz;
+  TEST_ASSERT_TRUE(tz.begin("<+0530>-5:30"));
+  TEST_ASSERT_EQUAL(19800, tz.getOffset(cet_dst_start_2024));
+  TEST_ASSERT_FALSE(tz.isDst(cet_dst_start_2024));
+  TEST_ASSERT_EQUAL(0, tz.getNextTransition(cet_dst_start_2024));
+}
+
+void test_invalid_strings(void) {
+  TimeZone tz;
+  TEST_ASSERT_FALSE(tz.begin(NULL));
+  TEST_ASSERT_FALSE(tz.begin(""));
+  TEST_ASSERT_FALSE(tz.begin("AB1"));                        // name too short
+  TEST_ASSERT_FALSE(tz.begin("CET"));                        // no offset
+  TEST_ASSERT_FALSE(tz.begin("CET-1CEST,M13.1.0,M10.5.0"));  // month
+  TEST_ASSERT_FALSE(tz.begin("CET-1CEST,M3.6.0,M10.5.0"));   // week
+  TEST_ASSERT_FALSE(tz.begin("CET-1CEST,M3.5.7,M10.5.0"));   // weekday
+  TEST_ASSERT_FALSE(tz.begin("CET-1CEST,M3.5.0"));           // no end rule
+  TEST_ASSERT_FALSE(tz.begin("CET-1CEST,J0,J300"));          // J starts at 1
+  TEST_ASSERT_FALSE(tz.begin("CET-1CEST,M3.5.0,M10.5.0x"));  // trailing garbage
+  TEST_ASSERT_FALSE(tz.isValid());
+  // A failed begin() leaves the zone at UTC.
+  TEST_ASSERT_EQUAL(0, tz.getOffset(cet_dst_start_2024));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_central_europe);
+  RUN_TEST(test_us_eastern);
+  RUN_TEST(test_dst_name_without_rules_uses_us_rules);
+  RUN_TEST(test_southern_hemisphere);
+  RUN_TEST(test_negative_rule_time);
+  RUN_TEST(test_rule_time_beyond_a_day);
+  RUN_TEST(test_julian_without_leap_day);
+  RUN_TEST(test_julian_zero_based);
+  RUN_TEST(test_fixed_offset);
+  RUN_TEST(test_invalid_strings);
+  return UNITY_END();
+}